@@ -1,6 +1,8 @@
 #include "Arduino.h"
 #include <cstring>
 
+unsigned long global_millis = 0;
+
 void
 MockArduino::yield()
 {
@@ -26,7 +28,12 @@ MockArduino::pinMode(uint8_t arg_1, uint8_t arg_2){
 unsigned long
 MockArduino::millis()
 {
-  MOCK_FUNC_R0(unsigned long) return 0;
+  MOCK_FUNC_R0(unsigned long) return global_millis;
+}
+unsigned long
+MockArduino::micros()
+{
+  MOCK_FUNC_R0(unsigned long) return global_millis * 1000;
 }
 void
 MockArduino::configTime(const char* zone, const char* server)
@@ -79,8 +86,18 @@ millis()
 {
   return GlobalArduino.millis();
 }
+unsigned long
+micros()
+{
+  return GlobalArduino.micros();
+}
 void
 configTime(const char* zone, const char* server)
 {
   GlobalArduino.configTime(zone, server);
 }
+void
+AdvanceGlobalMillis(unsigned long ms)
+{
+  global_millis += ms;
+}
@@ -30,6 +30,7 @@ public:
   void pinMode(uint8_t arg_1, uint8_t arg_2);
   uint8_t digitalRead(uint8_t arg_1);
   unsigned long millis();
+  unsigned long micros();
   // Not an Arduino function, but it's easiest to put here
   void configTime(const char* zone, const char* server);
 };
@@ -46,7 +47,13 @@ uint8_t
 digitalRead(uint8_t arg_1);
 unsigned long
 millis();
+unsigned long
+micros();
 void
 configTime(const char* zone, const char* server);
 
+// Moves the mock clock returned by millis() and micros() forward
+void
+AdvanceGlobalMillis(unsigned long ms);
+
 #endif
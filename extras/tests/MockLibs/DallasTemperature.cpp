@@ -1,4 +1,28 @@
 #include "DallasTemperature.h"
+#include <cstring>
+
+static int instances = 0;
+
+DallasTemperature::DallasTemperature()
+  : id(instances++)
+{
+}
+DallasTemperature::DallasTemperature(OneWire* bus)
+  : id(instances++)
+{
+}
+std::string
+DallasTemperature::GetName()
+{
+  if (id == 0) {
+    return "DallasTemperature";
+  }
+  return std::format("DallasTemperature{0}", id);
+}
+void
+DallasTemperature::setOneWire(OneWire* bus)
+{
+}
 
 void
 DallasTemperature::begin()
@@ -13,8 +37,17 @@ DallasTemperature::getDeviceCount()
 bool
 DallasTemperature::getAddress(uint8_t* addr, uint8_t arg_1)
 {
-  MOCK_FUNC_R1(bool, int)
-  *addr = arg_1;
+  MOCK_FUNC_V1(int)
+  // A DS18B20 ROM that's unique to the bus and index, unless one is given
+  memset(addr, 0, 8);
+  addr[0] = 0x28;
+  addr[1] = arg_1;
+  addr[2] = id;
+  if (!expects_map["getAddress.buffer"].empty()) {
+    memcpy(addr, expects_map["getAddress.buffer"].top(), 8);
+    expects_map["getAddress.buffer"].pop();
+  }
+  MOCK_RETURN(bool)
   return true;
 }
 void
@@ -23,12 +56,27 @@ DallasTemperature::setResolution(uint8_t arg_1)
   MOCK_FUNC_V1(int)
 }
 void
+DallasTemperature::setWaitForConversion(bool arg_1)
+{
+  MOCK_FUNC_V1(bool)
+}
+void
 DallasTemperature::requestTemperatures()
 {
   MOCK_FUNC_V0
 }
+bool
+DallasTemperature::readScratchPad(const uint8_t* addr, uint8_t* scratch_pad)
+{
+  // Sensors that fail a read are gone, unless told otherwise
+  MOCK_FUNC_R0(bool) return false;
+}
 float
 DallasTemperature::getTempC(const uint8_t* addr)
 {
-  MOCK_FUNC_R0(float) return 0;
+  std::string key;
+  MOCK_COUNT
+  // Checks which probe is read, by the index in its mock ROM
+  MOCK_ARG_CHECK("index", int, addr[1])
+  MOCK_RETURN(float) return 0;
 }
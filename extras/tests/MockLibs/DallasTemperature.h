@@ -7,14 +7,22 @@
 class DallasTemperature : public MockLib
 {
 public:
-  DallasTemperature(OneWire* bus) {}
-  std::string GetName() override { return "DallasTemperature"; }
+  DallasTemperature();
+  DallasTemperature(OneWire* bus);
+  // The first instance is "DallasTemperature", the rest are numbered
+  std::string GetName() override;
+  void setOneWire(OneWire* bus);
   void begin();
   int getDeviceCount();
   bool getAddress(uint8_t* arg_1, uint8_t arg_2);
   void setResolution(uint8_t arg_1);
+  void setWaitForConversion(bool arg_1);
   void requestTemperatures();
   float getTempC(const uint8_t* arg_1);
+  bool readScratchPad(const uint8_t* addr, uint8_t* scratch_pad);
+
+private:
+  int id;
 };
 
 #endif
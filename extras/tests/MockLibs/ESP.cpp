@@ -32,3 +32,8 @@ ESPClass::getHeapFragmentation()
 {
   MOCK_FUNC_R0(int) return 0;
 }
+uint32_t
+ESPClass::random()
+{
+  MOCK_FUNC_R0(uint32_t) return 0;
+}
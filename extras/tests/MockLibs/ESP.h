@@ -12,6 +12,7 @@ public:
   int getChipId();
   int getFreeHeap();
   int getHeapFragmentation();
+  uint32_t random();
   std::string GetName() override { return "ESP"; }
 };
 
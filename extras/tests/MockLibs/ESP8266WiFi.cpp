@@ -1,6 +1,11 @@
 #include "ESP8266WiFi.h"
+#include <cstring>
 
 std::vector<std::string> global_net_log;
+extern std::string global_input_stream;
+extern int global_input_stream_loc;
+
+ESP8266WiFiClass WiFi;
 
 WiFiClient::WiFiClient()
 {
@@ -17,6 +22,12 @@ WiFiClient::connect(const char* host, int arg_1)
   return true;
 }
 bool
+WiFiClient::connect(IPAddress ip, int arg_1)
+{
+  MOCK_FUNC_R1(bool, int)
+  return true;
+}
+bool
 WiFiClient::connected()
 {
   MOCK_FUNC_R0(bool) return true;
@@ -24,6 +35,46 @@ WiFiClient::connected()
 void
 WiFiClient::stop(){ MOCK_FUNC_V0 }
 
+size_t
+WiFiClient::write(const uint8_t* data, size_t arg_1)
+{
+  AddToBuffer(std::string((const char*)data, arg_1));
+  MOCK_FUNC_R1(size_t, size_t)
+  return arg_1;
+}
+int
+WiFiClient::availableForWrite()
+{
+  MOCK_FUNC_R0(int) return 1460;
+}
+int
+WiFiClient::available()
+{
+  MOCK_FUNC_R0(int)
+  return global_input_stream.length() - global_input_stream_loc;
+}
+int
+WiFiClient::read()
+{
+  MOCK_FUNC_R0(int)
+  if (global_input_stream_loc < global_input_stream.length()) {
+    return global_input_stream.at(global_input_stream_loc++);
+  }
+  return -1;
+}
+int
+WiFiClient::read(uint8_t* buffer, size_t arg_1)
+{
+  MOCK_FUNC_R1(int, size_t)
+  size_t len = global_input_stream.length() - global_input_stream_loc;
+  if (arg_1 < len) {
+    len = arg_1;
+  }
+  memcpy(buffer, global_input_stream.data() + global_input_stream_loc, len);
+  global_input_stream_loc += len;
+  return len;
+}
+
 WiFiServer::WiFiServer(int port)
 {}
 void
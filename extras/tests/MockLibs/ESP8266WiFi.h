@@ -4,9 +4,34 @@
 #include "ESP.h"
 #include "MockLib.h"
 #include "Stream.h"
+#include "lwip/ip_addr.h"
 #include <string>
 #include <vector>
 
+class IPAddress
+{
+public:
+  IPAddress(uint32_t address = 0)
+    : address(address)
+  {}
+  IPAddress(const ip_addr_t* address)
+    : address(address->addr)
+  {}
+  operator uint32_t() const { return address; }
+  bool isSet() const { return address != 0; }
+
+private:
+  uint32_t address;
+};
+
+class ESP8266WiFiClass : public MockLib
+{
+public:
+  std::string GetName() override { return "WiFi"; }
+};
+
+extern ESP8266WiFiClass WiFi;
+
 class WiFiClient : public Stream
 {
 public:
@@ -14,7 +39,15 @@ public:
   WiFiClient(std::vector<std::string>* log);
   std::string GetName() override { return "WiFiClient"; }
   bool connect(const char* host, int arg_1);
+  bool connect(IPAddress ip, int arg_1);
   bool connected();
+  // Reads and writes go to the global input stream and net log
+  using Print::write;
+  size_t write(const uint8_t* data, size_t arg_1);
+  int availableForWrite();
+  int available();
+  int read();
+  int read(uint8_t* buffer, size_t arg_1);
   void stop();
   bool has_data = false;
   operator bool() const { return has_data; }
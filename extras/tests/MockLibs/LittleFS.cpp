@@ -2,16 +2,65 @@
 
 LittleFSClass LittleFS;
 
+File::File(std::string* contents, size_t pos)
+  : contents(contents)
+  , pos(pos)
+{
+}
 void
 File::close()
 {
   MOCK_FUNC_V0
 }
+size_t
+File::write(const uint8_t* data, size_t arg_1)
+{
+  return write((const char*)data, arg_1);
+}
+size_t
+File::write(const char* data, size_t arg_1)
+{
+  if (!contents) {
+    return Stream::write(data, arg_1);
+  }
+  MOCK_FUNC_R1(size_t, size_t)
+  contents->replace(pos, arg_1, data, arg_1);
+  pos += arg_1;
+  return arg_1;
+}
+size_t
+File::readBytes(char* buffer, size_t arg_1)
+{
+  if (!contents) {
+    return Stream::readBytes(buffer, arg_1);
+  }
+  MOCK_FUNC_R1(size_t, size_t)
+  size_t len = contents->copy(buffer, arg_1, pos);
+  pos += len;
+  return len;
+}
+bool
+File::seek(uint32_t arg_1)
+{
+  MOCK_FUNC_R1(bool, uint32_t)
+  if (!contents || arg_1 > contents->size()) {
+    return false;
+  }
+  pos = arg_1;
+  return true;
+}
+size_t
+File::size()
+{
+  return contents ? contents->size() : 0;
+}
 
 bool
 LittleFSClass::format()
 {
-  MOCK_FUNC_R0(bool) return true;
+  MOCK_FUNC_R0(bool)
+  files.clear();
+  return true;
 }
 bool
 LittleFSClass::begin()
@@ -26,10 +75,22 @@ LittleFSClass::end()
 bool
 LittleFSClass::exists(const char* path)
 {
-  MOCK_FUNC_R0(bool) return false;
+  MOCK_FUNC_R0(bool) return files.count(path) > 0;
+}
+bool
+LittleFSClass::remove(const char* path)
+{
+  MOCK_FUNC_R0(bool) return files.erase(path) > 0;
 }
 File
 LittleFSClass::open(const char* path, const char* mode)
 {
-  MOCK_FUNC_R0(File) return File();
+  MOCK_FUNC_R0(File)
+  if (mode[0] == 'w') {
+    files[path] = "";
+  } else if (mode[0] == 'r' && !files.count(path)) {
+    return File();
+  }
+  std::string* contents = &files[path];
+  return File(contents, mode[0] == 'a' ? contents->size() : 0);
 }
@@ -3,11 +3,29 @@
 
 #include "MockLib.h"
 #include "Stream.h"
+#include <map>
+#include <string>
 
+/*
+ * Files opened from the in-memory filesystem read and write its contents.
+ * Other files, like those queued as return values, act as a plain Stream.
+ */
 class File : public Stream
 {
 public:
+  File() {}
+  File(std::string* contents, size_t pos);
   void close();
+  size_t write(const uint8_t* data, size_t arg_1);
+  size_t write(const char* data, size_t arg_1);
+  size_t readBytes(char* buffer, size_t arg_1);
+  bool seek(uint32_t arg_1);
+  size_t size();
+  operator bool() const { return contents != NULL; }
+
+private:
+  std::string* contents = NULL;
+  size_t pos = 0;
 };
 
 class LittleFSClass : public MockLib
@@ -18,7 +36,10 @@ public:
   bool begin();
   void end();
   bool exists(const char* path);
+  bool remove(const char* path);
   File open(const char* path, const char* mode);
+  // Contents of the in-memory filesystem, by path
+  std::map<std::string, std::string> files;
 };
 
 extern LittleFSClass LittleFS;
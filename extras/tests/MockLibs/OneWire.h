@@ -4,7 +4,9 @@
 class OneWire
 {
 public:
+  OneWire();
   OneWire(int bus);
+  void begin(int bus);
 };
 
 #endif
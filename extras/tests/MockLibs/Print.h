@@ -13,7 +13,7 @@ struct Print : public MockLib
 {
 public:
   std::string GetName() override { return "Print"; }
-  size_t write(const uint8_t* data, size_t arg_1);
+  virtual size_t write(const uint8_t* data, size_t arg_1);
   size_t write(uint8_t arg_1);
   size_t write(const char* data, size_t arg_1);
   void flush();
@@ -38,10 +38,12 @@ public:
 
   void AddOutputBuffer(std::vector<std::string>* out);
 
-private:
-  std::vector<std::string>* print_buffer = NULL;
+protected:
   void AddToBuffer(const char* line);
   void AddToBuffer(std::string line);
+
+private:
+  std::vector<std::string>* print_buffer = NULL;
 };
 
 #endif
@@ -22,8 +22,8 @@ ReadBufferingStream::available()
 int
 ReadBufferingStream::find(const char* match)
 {
-  int pos = global_input_stream.find(match);
-  if (pos >= global_input_stream_loc) {
+  size_t pos = global_input_stream.find(match, global_input_stream_loc);
+  if (pos != std::string::npos) {
     global_input_stream_loc = pos + strlen(match);
     return true;
   }
@@ -54,7 +54,7 @@ ReadBufferingStream::parseInt()
 size_t
 ReadBufferingStream::readBytes(char* buffer, size_t arg_1)
 {
-  if (global_input_stream.length() - global_input_stream_loc > arg_1) {
+  if (global_input_stream.length() - global_input_stream_loc < arg_1) {
     arg_1 = global_input_stream.length() - global_input_stream_loc;
   }
   for (int i = 0; i < arg_1; i++) {
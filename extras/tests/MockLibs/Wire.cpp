@@ -6,6 +6,16 @@ WireClass::begin()
   MOCK_FUNC_V0
 }
 void
+WireClass::setClock(uint32_t arg_1)
+{
+  MOCK_FUNC_V1(uint32_t)
+}
+void
+WireClass::setClockStretchLimit(uint32_t arg_1)
+{
+  MOCK_FUNC_V1(uint32_t)
+}
+void
 WireClass::beginTransmission(uint8_t arg_1){
   MOCK_FUNC_V1(uint8_t)
 } uint8_t WireClass::endTransmission()
@@ -8,6 +8,8 @@ class WireClass : public MockLib
 public:
   std::string GetName() override { return "Wire"; }
   void begin();
+  void setClock(uint32_t arg_1);
+  void setClockStretchLimit(uint32_t arg_1);
   void beginTransmission(uint8_t arg_1);
   uint8_t endTransmission();
   uint8_t requestFrom(uint8_t arg_1, uint8_t arg_2);
@@ -9,3 +9,7 @@
 #ifndef PROGMEM
 #define PROGMEM
 #endif
+
+#ifndef pgm_read_byte
+#define pgm_read_byte(addr) (*(const unsigned char*)(addr))
+#endif
@@ -0,0 +1,41 @@
+#include "lwip/dns.h"
+
+LwipDns GlobalDns;
+dns_found_callback pending_found = NULL;
+void* pending_arg = NULL;
+const char* pending_name = NULL;
+
+int
+LwipDns::gethostbyname()
+{
+  MOCK_FUNC_R0(int) return ERR_OK;
+}
+
+err_t
+dns_gethostbyname(const char* hostname,
+                  ip_addr_t* addr,
+                  dns_found_callback found,
+                  void* callback_arg)
+{
+  err_t err = GlobalDns.gethostbyname();
+  if (err == ERR_OK) {
+    addr->addr = 0x0100007f;
+  } else if (err == ERR_INPROGRESS) {
+    pending_found = found;
+    pending_arg = callback_arg;
+    pending_name = hostname;
+  }
+  return err;
+}
+
+void
+FinishDnsLookup(uint32_t address)
+{
+  if (!pending_found) {
+    return;
+  }
+  ip_addr_t addr = { .addr = address };
+  dns_found_callback found = pending_found;
+  pending_found = NULL;
+  found(pending_name, address ? &addr : NULL, pending_arg);
+}
@@ -0,0 +1,39 @@
+#ifndef LWIP_DNS_H
+#define LWIP_DNS_H
+
+#include "../MockLib.h"
+#include "ip_addr.h"
+
+typedef signed char err_t;
+#define ERR_OK 0
+#define ERR_INPROGRESS -5
+#define ERR_ARG -16
+
+typedef void (*dns_found_callback)(const char* name,
+                                   const ip_addr_t* ipaddr,
+                                   void* callback_arg);
+
+class LwipDns : public MockLib
+{
+public:
+  std::string GetName() override { return "dns"; }
+  int gethostbyname();
+};
+
+/*
+ * Answers with 127.0.0.1 right away, unless gethostbyname is set to return
+ * ERR_INPROGRESS. Then the lookup waits for FinishDnsLookup.
+ */
+err_t
+dns_gethostbyname(const char* hostname,
+                  ip_addr_t* addr,
+                  dns_found_callback found,
+                  void* callback_arg);
+
+/*
+ * Answers the lookup that's in progress, with 0 for a name that wasn't found.
+ */
+void
+FinishDnsLookup(uint32_t address);
+
+#endif
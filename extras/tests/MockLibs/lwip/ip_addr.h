@@ -0,0 +1,11 @@
+#ifndef LWIP_IP_ADDR_H
+#define LWIP_IP_ADDR_H
+
+#include <cstdint>
+
+typedef struct ip_addr
+{
+  uint32_t addr;
+} ip_addr_t;
+
+#endif
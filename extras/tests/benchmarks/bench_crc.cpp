@@ -0,0 +1,56 @@
+#include <CRC.h>
+#include <chrono>
+#include <cstdio>
+
+#define BENCH_WORDS 0x10000
+#define BENCH_ROUNDS 200
+
+/*
+ * The bitwise CRC-8 the SHT40 reads used before the lookup table.
+ */
+byte
+crc8_bitwise(int value)
+{
+  byte crc = 0xFF;
+  for (byte bit = 16; bit > 0; bit--) {
+    if (((value & 0x8000) >> 8) == (crc & 0x80))
+      crc = (crc << 1);
+    else
+      crc = (crc << 1) ^ 0x31;
+    value = (value << 1) & 0xFFFF;
+  }
+  return crc;
+}
+
+/*
+ * Runs a CRC over every 16 bit word, returning the ns taken per word.
+ */
+template<typename F>
+double
+time_words(F crc, byte& sink)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    for (unsigned int value = 0; value < BENCH_WORDS; value++) {
+      sink ^= crc(value);
+    }
+  }
+  std::chrono::duration<double, std::nano> taken =
+    std::chrono::steady_clock::now() - start;
+  return taken.count() / ((double)BENCH_ROUNDS * BENCH_WORDS);
+}
+
+int
+main(void)
+{
+  // Folding the results together keeps the loops from being optimized out
+  byte sink = 0;
+  double bitwise = time_words([](unsigned int v) { return crc8_bitwise(v); },
+                              sink);
+  double table = time_words([](unsigned int v) { return crc8_word(v); }, sink);
+
+  printf("crc8 bitwise: %6.2f ns/word\n", bitwise);
+  printf("crc8 table:   %6.2f ns/word (%.1fx)\n", table, bitwise / table);
+  printf("check: %02X\n", sink);
+  return 0;
+}
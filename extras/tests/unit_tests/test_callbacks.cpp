@@ -58,7 +58,6 @@ test_event_handler_called()
 
   // Run handler until time changes
   while (start_time == current_time) {
-    MockTherm->Returns("getAddress", 1, &boolt);
     underTest.handle_events();
   }
   assert(MockTherm->Called("getTempC") == 1);
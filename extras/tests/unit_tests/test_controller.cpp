@@ -77,10 +77,93 @@ test_correct_checksum()
   assert(MockWireLib->Called("write") > 0);
 }
 
+void
+test_v2_acknowledged_write()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+    .output_protocol = OUTPUT_PROTOCOL_V2,
+  };
+
+  // Get mock Wire library
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  MockWireLib->Reset();
+
+  testHarness.init(&config);
+
+  // Set some values
+  testHarness.set_analog(50);
+  testHarness.set_digital_2(1);
+  testHarness.set_digital_1(1);
+
+  // Check that the frame is sent with a CRC
+  int b1 = 50, b2 = 3, b3 = 0xb9;
+  MockWireLib->Expects("write.arg_1", 3, &b3, &b2, &b1);
+
+  // Have the controller report back the same state
+  int three = 3;
+  uint8_t applied[3] = { 50, 3, 0xb9 };
+  MockWireLib->Returns("requestFrom", 1, &three);
+  MockWireLib->Returns("read", 3, applied + 2, applied + 1, applied);
+
+  testHarness.write_outputs();
+  assert(MockWireLib->Called("write") == 3);
+  assert(MockWireLib->Called("requestFrom") == 1);
+  assert(testHarness.outputs_acknowledged());
+
+  // Once acknowledged, nothing more is sent
+  testHarness.write_outputs();
+  assert(MockWireLib->Called("write") == 3);
+  assert(MockWireLib->Called("requestFrom") == 1);
+}
+
+void
+test_v2_unacknowledged_write()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+    .output_protocol = OUTPUT_PROTOCOL_V2,
+  };
+
+  // Get mock Wire library
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  MockWireLib->Reset();
+
+  testHarness.init(&config);
+  testHarness.set_analog(50);
+
+  // Have the controller report back a stale state
+  int three = 3;
+  uint8_t applied[3] = { 0, 0, 0 };
+  MockWireLib->Returns("requestFrom", 1, &three);
+  MockWireLib->Returns("read", 3, applied + 2, applied + 1, applied);
+  testHarness.write_outputs();
+  assert(!testHarness.outputs_acknowledged());
+  assert(MockWireLib->Called("requestFrom") == 1);
+
+  // The frame is resent, but not forever when the controller doesn't answer
+  for (int i = 0; i < 10; i++) {
+    testHarness.write_outputs();
+  }
+  assert(MockWireLib->Called("requestFrom") == NUM_SEND_ATTEMPTS);
+  assert(MockWireLib->Called("write") == 3 * NUM_SEND_ATTEMPTS);
+  assert(!testHarness.outputs_acknowledged());
+}
+
 int
 main(void)
 {
   test_clean_and_dirty_write();
   test_correct_checksum();
+  test_v2_acknowledged_write();
+  test_v2_unacknowledged_write();
   return 0;
 }
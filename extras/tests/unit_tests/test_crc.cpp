@@ -0,0 +1,54 @@
+#include <CRC.h>
+#include <cassert>
+
+/*
+ * The CRC-8 from the SHT40 datasheet, one bit at a time.
+ */
+byte
+crc8_bitwise(const byte* data, size_t len)
+{
+  byte crc = CRC8_INIT;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (byte bit = 8; bit > 0; bit--) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+void
+test_crc8_datasheet_example()
+{
+  // Example from the SHT4x datasheet
+  byte data[2] = { 0xBE, 0xEF };
+  assert(crc8(data, 2) == 0x92);
+  assert(crc8_word(0xBEEF) == 0x92);
+}
+
+void
+test_crc8_matches_bitwise()
+{
+  for (unsigned int value = 0; value <= 0xFFFF; value++) {
+    byte data[2] = { (byte)(value >> 8), (byte)value };
+    assert(crc8_word(value) == crc8_bitwise(data, 2));
+  }
+}
+
+void
+test_crc8_continues()
+{
+  byte data[5] = { 0x01, 0x23, 0x45, 0x67, 0x89 };
+  byte crc = crc8(data, 2);
+  assert(crc8(data + 2, 3, crc) == crc8(data, 5));
+  assert(crc8(data, 5) == crc8_bitwise(data, 5));
+}
+
+int
+main(void)
+{
+  test_crc8_datasheet_example();
+  test_crc8_matches_bitwise();
+  test_crc8_continues();
+  return 0;
+}
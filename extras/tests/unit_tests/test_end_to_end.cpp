@@ -30,7 +30,7 @@ test_sends_stats_and_update(VivariumMonitor& underTest)
   underTest.handle_events();
 
   // Check we posted stats
-  assert(LogHasText("POST /stats/post HTTP/1.0"));
+  assert(LogHasText("POST /stats/post HTTP/1.1"));
 
   // Check we queried for update
   assert(LogHasText("GET /test HTTP/1.0\r\n"));
@@ -71,7 +71,7 @@ test_sends_stats_again(VivariumMonitor& underTest)
   underTest.handle_events();
 
   // Check we posted stats with new reading
-  assert(LogHasText("POST /stats/post HTTP/1.0"));
+  assert(LogHasText("POST /stats/post HTTP/1.1"));
   assert(LogHasText("\"high_temp\":17.00"));
   assert(MockTherm->Called("getTempC") == 2);
 }
@@ -134,6 +134,9 @@ main(void)
   // Setup
   underTest.init(config);
 
+  // The V1 output protocol has no acknowledgements
+  assert(!underTest.outputsAcknowledged());
+
   // Run tests
   test_sends_stats_and_update(underTest);
   test_respects_intervals(underTest);
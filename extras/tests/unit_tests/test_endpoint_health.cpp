@@ -0,0 +1,77 @@
+#include <ESP.h>
+#include <EndpointHealth.h>
+#include <MockLib.h>
+#include <cassert>
+
+void
+test_backs_off_with_jitter()
+{
+  MockLib* MockESP = GetMock("ESP");
+  assert(MockESP != NULL);
+  MockESP->Reset();
+  EndpointHealth health;
+  health.init(10, 600);
+  assert(health.ready(100));
+
+  // Waits between half and all of the backoff, doubling each time
+  uint32_t none = 0, most = 5, all = 10;
+  MockESP->Returns("random", 3, &all, &none, &most);
+  health.failure(100);
+  assert(health.state() == BREAKER_CLOSED);
+  assert(health.failures() == 1);
+  assert(health.retryAt() == 110);
+  assert(!health.ready(109));
+  assert(health.ready(110));
+  health.failure(110);
+  assert(health.retryAt() == 120);
+  health.failure(120);
+  assert(health.retryAt() == 150);
+
+  // Answering starts over
+  health.success();
+  assert(health.failures() == 0);
+  assert(health.retryAt() == 0);
+  assert(health.ready(150));
+}
+
+void
+test_breaker_probes_once()
+{
+  EndpointHealth health;
+  health.init(10, 600);
+
+  // Opens after enough failures in a row
+  for (int i = 1; i < BREAKER_FAILURES; i++) {
+    health.failure(0);
+    assert(health.state() == BREAKER_CLOSED);
+  }
+  health.failure(1000);
+  assert(health.state() == BREAKER_OPEN);
+  assert(health.retryAt() == 1600);
+  assert(!health.ready(1599));
+
+  // Only one probe goes out after the cool-down
+  assert(health.ready(1600));
+  assert(health.state() == BREAKER_HALF_OPEN);
+  assert(!health.ready(1601));
+
+  // A failed probe opens it again
+  health.failure(1610);
+  assert(health.state() == BREAKER_OPEN);
+  assert(health.retryAt() == 2210);
+
+  // A good one closes it
+  assert(health.ready(2210));
+  health.success();
+  assert(health.state() == BREAKER_CLOSED);
+  assert(health.ready(2211));
+  assert(health.ready(2212));
+}
+
+int
+main(void)
+{
+  test_backs_off_with_jitter();
+  test_breaker_probes_once();
+  return 0;
+}
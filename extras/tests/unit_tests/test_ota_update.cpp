@@ -227,6 +227,53 @@ test_ota_update_fails_to_finalize()
   assert(MockESP->Called("restart") == 0);
 }
 
+void
+test_ota_retries_failed_check()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+  };
+  Url update_url = {
+    .host = "example.org",
+    .path = "/test",
+    .port = 8000,
+    .set = true,
+  };
+
+  // Init the library
+  testHarness.init(&config, update_url);
+
+  MockLib *MockESP = GetMock("ESP"), *MockUpdate = GetMock("Update");
+  assert(MockESP != NULL);
+  assert(MockUpdate != NULL);
+  MockESP->Reset();
+  MockUpdate->Reset();
+  SetGlobalInputStream(
+    "HTTP/1.2 503 Unavailable\r\nConnection: close\r\n\r\n");
+
+  ClearGlobalNetLog();
+  testHarness.update_firmware(20000);
+  assert(LogHasText("GET /test HTTP/1.0\r\n"));
+
+  // A failed check is retried after the backoff, not the check interval
+  ClearGlobalNetLog();
+  testHarness.update_firmware(20000 + FIRMWARE_BACKOFF_SECONDS / 2 - 1);
+  assert(!LogHasText("GET"));
+  SetGlobalInputStream(
+    "HTTP/1.2 304 Not Modified\r\nConnection: close\r\n\r\n");
+  testHarness.update_firmware(20000 + FIRMWARE_BACKOFF_SECONDS / 2);
+  assert(LogHasText("GET /test HTTP/1.0\r\n"));
+
+  // Once it succeeds the check interval applies again
+  ClearGlobalNetLog();
+  testHarness.update_firmware(20000 + FIRMWARE_BACKOFF_SECONDS);
+  assert(!LogHasText("GET"));
+  assert(MockUpdate->Called("begin") == 0);
+}
+
 int
 main(void)
 {
@@ -235,5 +282,6 @@ main(void)
   test_ota_update_fails_to_start();
   test_ota_update_fails_no_space();
   test_ota_update_fails_to_finalize();
+  test_ota_retries_failed_check();
   return 0;
 }
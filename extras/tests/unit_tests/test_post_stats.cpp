@@ -1,23 +1,54 @@
+#include <Arduino.h>
 #include <ESP8266WiFi.h>
+#include <LittleFS.h>
 #include <MockLib.h>
 #include <Network.h>
+#include <StreamUtils.h>
 #include <cassert>
+#include <lwip/dns.h>
+
+/*
+ * Sets the time of a sample and every reading in it.
+ */
+void
+stamp_readings(SensorData& readings, time_t now)
+{
+  readings.timestamp = now;
+  readings.humidity.timestamp = now;
+  readings.air_temp.timestamp = now;
+  readings.high_temp.timestamp = now;
+  readings.low_temp.timestamp = now;
+  for (int i = 0; i < MAX_THERM_SENSORS; i++) {
+    readings.probes[i].timestamp = now;
+  }
+}
+
+/*
+ * Answers the next stats request with an empty 200 response.
+ */
+void
+respond_ok()
+{
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+}
 
 void
 test_initial_bad_sends_nulls(Network& testHarness)
 {
   SensorData readings = {
-    .humidity = { .has_error = false, .value = 60.0 },
-    .air_temp = { .has_error = false, .value = 24.33 },
-    .high_temp = { .has_error = true, .value = 255.0 },
-    .low_temp = { .has_error = true, .value = -128.0 },
+    .humidity = { .error = SENSOR_OK, .value = 60.0 },
+    .air_temp = { .error = SENSOR_OK, .value = 24.33 },
+    .high_temp = { .error = SENSOR_CRC_ERROR, .value = 255.0 },
+    .low_temp = { .error = SENSOR_CRC_ERROR, .value = -128.0 },
     .timestamp = 10,
   };
+  stamp_readings(readings, 10);
 
   // Call post_stats with bad first reading
   ClearGlobalNetLog();
+  respond_ok();
   testHarness.post_stats(readings, 0, 1, 20);
-  assert(LogHasText("POST /statsendpoint HTTP/1.0"));
+  assert(LogHasText("POST /statsendpoint HTTP/1.1"));
   assert(LogHasText("Host: test.com:5883"));
   assert(LogHasText("00:10")); // timestamp
   assert(LogHasText("\"high_temp\":null"));
@@ -36,17 +67,19 @@ test_post_stats_good(Network& testHarness)
   assert(MockESP != NULL);
 
   SensorData readings = {
-    .humidity = { .has_error = false, .value = 54.6 },
-    .air_temp = { .has_error = false, .value = 22.34 },
-    .high_temp = { .has_error = false, .value = 25.0 },
-    .low_temp = { .has_error = false, .value = 20.0 },
+    .humidity = { .error = SENSOR_OK, .value = 54.6 },
+    .air_temp = { .error = SENSOR_OK, .value = 22.34 },
+    .high_temp = { .error = SENSOR_OK, .value = 25.0 },
+    .low_temp = { .error = SENSOR_OK, .value = 20.0 },
     .timestamp = 20,
   };
+  stamp_readings(readings, 20);
   int id = 12345;
   MockESP->Returns("getChipId", 1, &id);
 
   // Check we get our readings back
   ClearGlobalNetLog();
+  respond_ok();
   testHarness.post_stats(readings, 0, 1, 36);
   assert(LogHasText("POST"));
   assert(LogHasText("00:20")); // timestamp
@@ -60,16 +93,17 @@ test_post_stats_good(Network& testHarness)
   assert(LogHasText("\"analog\":36"));
 
   // Call post_stats again, but with a short time delta
-  readings.timestamp = 22;
+  stamp_readings(readings, 22);
   ClearGlobalNetLog();
   testHarness.post_stats(readings, 0, 1, 36);
   assert(!LogHasText("POST"));
 
   // Try a new reading with enough time
-  readings.timestamp = 30;
+  stamp_readings(readings, 30);
   readings.high_temp.value = 28.0;
   readings.air_temp.value = 25.67;
   ClearGlobalNetLog();
+  respond_ok();
   testHarness.post_stats(readings, 1, 0, 42);
   assert(LogHasText("00:30")); // timestamp
   assert(LogHasText("\"high_temp\":28.00"));
@@ -83,12 +117,13 @@ void
 test_get_good_value(Network& testHarness)
 {
   SensorData readings = {
-    .humidity = { .has_error = true, .value = 60.0 },
-    .air_temp = { .has_error = true, .value = 24.33 },
-    .high_temp = { .has_error = false, .value = 25.5 },
-    .low_temp = { .has_error = false, .value = 20.5 },
+    .humidity = { .error = SENSOR_CRC_ERROR, .value = 60.0 },
+    .air_temp = { .error = SENSOR_CRC_ERROR, .value = 24.33 },
+    .high_temp = { .error = SENSOR_OK, .value = 25.5 },
+    .low_temp = { .error = SENSOR_OK, .value = 20.5 },
     .timestamp = 32,
   };
+  stamp_readings(readings, 32);
 
   // Call post_stats again to feed in some (bad) data
   ClearGlobalNetLog();
@@ -96,26 +131,27 @@ test_get_good_value(Network& testHarness)
   assert(!LogHasText("POST"));
 
   ClearGlobalNetLog();
-  readings.timestamp = 34;
+  stamp_readings(readings, 34);
   readings.humidity.value = 70.0;
   testHarness.post_stats(readings, 0, 1, 120);
   assert(!LogHasText("POST"));
 
   // Now add some good data
   ClearGlobalNetLog();
-  readings.timestamp = 36;
+  stamp_readings(readings, 36);
   readings.humidity.value = 80.0;
-  readings.humidity.has_error = false;
-  readings.air_temp.has_error = false;
+  readings.humidity.error = SENSOR_OK;
+  readings.air_temp.error = SENSOR_OK;
   testHarness.post_stats(readings, 0, 1, 140);
   assert(!LogHasText("POST"));
 
   // Finally, add some bad data with a big enough time delta to send
   ClearGlobalNetLog();
-  readings.timestamp = 40;
+  stamp_readings(readings, 40);
   readings.humidity.value = 90.0;
-  readings.humidity.has_error = true;
-  readings.air_temp.has_error = true;
+  readings.humidity.error = SENSOR_CRC_ERROR;
+  readings.air_temp.error = SENSOR_CRC_ERROR;
+  respond_ok();
   testHarness.post_stats(readings, 1, 0, 160);
   assert(LogHasText("POST"));
   assert(LogHasText("00:36")); // timestamp
@@ -132,12 +168,13 @@ void
 test_sends_nulls(Network& testHarness)
 {
   SensorData readings = {
-    .humidity = { .has_error = true, .value = 60.0 },
-    .air_temp = { .has_error = true, .value = 25.33 },
-    .high_temp = { .has_error = false, .value = 26.5 },
-    .low_temp = { .has_error = false, .value = 21.5 },
+    .humidity = { .error = SENSOR_CRC_ERROR, .value = 60.0 },
+    .air_temp = { .error = SENSOR_CRC_ERROR, .value = 25.33 },
+    .high_temp = { .error = SENSOR_OK, .value = 26.5 },
+    .low_temp = { .error = SENSOR_OK, .value = 21.5 },
     .timestamp = 45,
   };
+  stamp_readings(readings, 45);
 
   // Call post_stats again to feed in some (bad) data
   ClearGlobalNetLog();
@@ -146,8 +183,9 @@ test_sends_nulls(Network& testHarness)
 
   // Finally, add some bad data with a big enough time delta to send
   ClearGlobalNetLog();
-  readings.timestamp = 50;
+  stamp_readings(readings, 50);
   readings.high_temp.value = 27.0;
+  respond_ok();
   testHarness.post_stats(readings, 1, 0, 160);
   assert(LogHasText("POST"));
   assert(LogHasText("00:50")); // timestamp
@@ -160,6 +198,718 @@ test_sends_nulls(Network& testHarness)
   assert(LogHasText("\"analog\":160"));
 }
 
+void
+test_posts_each_probe()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = false,
+        .num_therm_sensors = 3,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+
+  // Init the library
+  testHarness.init(&config, update_url);
+
+  SensorData readings = {
+    .high_temp = { .error = SENSOR_OK, .value = 25.0 },
+    .low_temp = { .error = SENSOR_OK, .value = 20.0 },
+    .probes = {
+      { .error = SENSOR_OK, .value = 25.0 },
+      { .error = SENSOR_MISSING, .value = -127.0 },
+      { .error = SENSOR_OK, .value = 20.0 },
+    },
+    .num_probes = 3,
+    .timestamp = 20,
+  };
+  stamp_readings(readings, 20);
+
+  // Check that every probe is sent, including the bad one
+  ClearGlobalNetLog();
+  respond_ok();
+  testHarness.post_stats(readings, 0, 1, 36);
+  assert(LogHasText("POST"));
+  assert(LogHasText("\"high_temp\":25.00"));
+  assert(LogHasText("\"low_temp\":20.00"));
+  assert(LogHasText("\"probes\":[25.00,null,20.00]"));
+}
+
+void
+test_posts_bus_health()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 0,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+  BusHealth health = {};
+  health.i2c.transactions = 4;
+  health.i2c.failures[2] = 1;
+  health.i2c.crc_failures = 2;
+  health.i2c.resets = 1;
+  health.i2c.latency_min = 10;
+  health.i2c.latency_max = 50;
+  health.i2c.latency_total = 100;
+  health.outputs_acknowledged = true;
+  config.output_protocol = OUTPUT_PROTOCOL_V2;
+
+  // Init the library
+  testHarness.init(&config, update_url, &health);
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 54.6 },
+    .air_temp = { .error = SENSOR_OK, .value = 22.34 },
+    .timestamp = 20,
+  };
+  stamp_readings(readings, 20);
+
+  ClearGlobalNetLog();
+  respond_ok();
+  testHarness.post_stats(readings, 0, 1, 36);
+  assert(LogHasText("\"i2c\":{\"n\":4,\"fail\":[0,0,1,0,0,0],\"crc\":2,"
+                    "\"resets\":1,\"us\":[10,25,50]}"));
+  assert(LogHasText("\"onewire\":{\"n\":0,"));
+  assert(LogHasText("\"outputs_acked\":true"));
+}
+
+void
+test_posts_running_stats()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 1,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+  testHarness.init(&config, update_url);
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 50.0 },
+    .air_temp = { .error = SENSOR_OK, .value = 20.0 },
+    .high_temp = { .error = SENSOR_OK, .value = 25.0 },
+    .low_temp = { .error = SENSOR_OK, .value = 25.0 },
+    .probes = { { .error = SENSOR_OK, .value = 25.0 } },
+    .num_probes = 1,
+  };
+  stamp_readings(readings, 10);
+
+  // The first post only has the first sample
+  ClearGlobalNetLog();
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("\"agg\":{\"humidity\":[1,50.00,50.00,50.00,0.00]"));
+
+  // Every sample in between is counted once
+  float humidity[] = { 54.0, 58.0, 62.0 };
+  for (int i = 0; i < 3; i++) {
+    stamp_readings(readings, 12 + 2 * i);
+    readings.humidity.value = humidity[i];
+    testHarness.post_stats(readings, 0, 0, 0);
+    testHarness.post_stats(readings, 0, 0, 0);
+  }
+
+  // Readings that weren't measured again, or have errors, are left out
+  readings.timestamp = 19;
+  readings.air_temp.error = SENSOR_CRC_ERROR;
+  testHarness.post_stats(readings, 0, 0, 0);
+
+  ClearGlobalNetLog();
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 20);
+  readings.humidity.value = 50.0;
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("POST"));
+  assert(LogHasText("\"agg\":{\"humidity\":[4,50.00,62.00,56.00,"
+                    "26.67],\"air_temp\":[3,20.00,20.00,20.00,0.00]"));
+  assert(LogHasText("\"probes\":[[4,25.00,25.00,25.00,0.00]]}"));
+
+  // Sending starts the stats over
+  ClearGlobalNetLog();
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 30);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("\"agg\":{\"humidity\":[1,50.00,"));
+  assert(LogHasText("\"air_temp\":null"));
+
+  // Unless the server didn't take them
+  ClearGlobalNetLog();
+  SetGlobalInputStream("HTTP/1.1 503 Unavailable\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 40);
+  testHarness.post_stats(readings, 0, 0, 0);
+  ClearGlobalNetLog();
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 50);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("\"agg\":{\"humidity\":[2,50.00,"));
+
+  // Samples that come in while a post is out go in the next report
+  SetGlobalInputStream("");
+  stamp_readings(readings, 60);
+  testHarness.post_stats(readings, 0, 0, 0);
+  stamp_readings(readings, 61);
+  readings.humidity.value = 40.0;
+  testHarness.post_stats(readings, 0, 0, 0);
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 62);
+  testHarness.post_stats(readings, 0, 0, 0);
+  ClearGlobalNetLog();
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 70);
+  readings.humidity.value = 50.0;
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("\"agg\":{\"humidity\":[3,40.00,50.00,43.33,"));
+}
+
+void
+test_keeps_connection_open()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 0,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+  LittleFS.files.clear();
+  testHarness.init(&config, update_url);
+
+  // The stats connection is the first client created
+  MockLib* MockClient = GetMock("WiFiClient");
+  assert(MockClient != NULL);
+  MockClient->Reset();
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 50.0 },
+    .air_temp = { .error = SENSOR_OK, .value = 20.0 },
+  };
+  stamp_readings(readings, 10);
+
+  // The first post connects, and the response body is read and thrown out
+  bool boolt = true, boolf = false;
+  MockClient->Returns("connected", 1, &boolf);
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 7\r\n\r\n"
+                       "thanks!HTTP/1.1 201 Created\r\n"
+                       "Content-Length: 0\r\n\r\n");
+  ClearGlobalNetLog();
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("POST /statsendpoint HTTP/1.1"));
+  assert(LogHasText("Connection: keep-alive"));
+  assert(MockClient->Called("connect") == 1);
+  assert(MockClient->Called("stop") == 0);
+
+  // The next post uses the same connection, and finds the next response
+  MockClient->Returns("connected", 1, &boolt);
+  stamp_readings(readings, 20);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 1);
+  assert(MockClient->Called("stop") == 0);
+
+  // The server closes it after this one
+  MockClient->Returns("connected", 1, &boolt);
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nconnection: close\r\n"
+                       "Content-Length: 0\r\n\r\n");
+  stamp_readings(readings, 30);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 1);
+  assert(MockClient->Called("stop") == 1);
+
+  // HTTP/1.0 servers close every connection
+  MockClient->Returns("connected", 1, &boolf);
+  SetGlobalInputStream("HTTP/1.0 200 OK\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 40);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 2);
+  assert(MockClient->Called("stop") == 2);
+
+  // A kept connection the server closed is opened again, once
+  MockClient->Returns("connected", 2, &boolf, &boolt);
+  SetGlobalInputStream("");
+  stamp_readings(readings, 50);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 3);
+  assert(MockClient->Called("stop") == 3);
+
+  // And given up on once the new one has been quiet too long
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("stop") == 3);
+  AdvanceGlobalMillis(STATS_READ_TIMEOUT);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 3);
+  assert(MockClient->Called("stop") == 4);
+
+  // A kept connection that times out after taking the request isn't opened
+  // again, the server may already have it
+  MockClient->Returns("connected", 1, &boolf);
+  respond_ok();
+  stamp_readings(readings, 80);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 4);
+  SetGlobalInputStream("");
+  ClearGlobalNetLog();
+  stamp_readings(readings, 90);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("POST /statsendpoint"));
+  AdvanceGlobalMillis(STATS_READ_TIMEOUT);
+  ClearGlobalNetLog();
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(!LogHasText("POST /statsendpoint"));
+  assert(MockClient->Called("connect") == 4);
+  assert(MockClient->Called("stop") == 5);
+}
+
+void
+test_keeps_chunked_connection_open()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 0,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+  LittleFS.files.clear();
+  testHarness.init(&config, update_url);
+
+  MockLib* MockClient = GetMock("WiFiClient");
+  assert(MockClient != NULL);
+  MockClient->Reset();
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 50.0 },
+    .air_temp = { .error = SENSOR_OK, .value = 20.0 },
+  };
+  stamp_readings(readings, 10);
+
+  // The chunks and trailer are thrown out, up to the next response
+  bool boolt = true, boolf = false;
+  MockClient->Returns("connected", 1, &boolf);
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                       "7;note=x\r\nthanks!\r\n"
+                       "e\r\nHTTP/1.1 500\r\n\r\n"
+                       "0\r\nX-Trailer: 1\r\n\r\n"
+                       "HTTP/1.1 201 Created\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n");
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 1);
+  assert(MockClient->Called("stop") == 0);
+
+  // The next post goes out on the same connection
+  MockClient->Returns("connected", 1, &boolt);
+  stamp_readings(readings, 20);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 1);
+  assert(MockClient->Called("stop") == 0);
+}
+
+void
+test_posts_without_blocking()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 0,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+  LittleFS.files.clear();
+  testHarness.init(&config, update_url);
+
+  MockLib* MockClient = GetMock("WiFiClient");
+  assert(MockClient != NULL);
+  MockClient->Reset();
+  MockLib* MockDns = GetMock("dns");
+  assert(MockDns != NULL);
+  MockDns->Reset();
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 50.0 },
+    .air_temp = { .error = SENSOR_OK, .value = 20.0 },
+  };
+
+  // The request is written as the connection has room for it
+  bool boolf = false;
+  int room = 16, full = 0;
+  unsigned long timeout = STATS_CONNECT_TIMEOUT;
+  MockClient->Returns("connected", 1, &boolf);
+  MockClient->Returns("availableForWrite", 2, &full, &room);
+  MockClient->Expects("setTimeout.arg_1", 1, &timeout);
+  SetGlobalInputStream("");
+  ClearGlobalNetLog();
+  stamp_readings(readings, 10);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockDns->Called("gethostbyname") == 1);
+  assert(MockClient->Called("connect") == 1);
+  assert(MockClient->Called("write") == 1);
+  assert(LogHasText("POST /statsend"));
+  assert(!LogHasText("Host:"));
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("Host: test.com:5883"));
+  assert(LogHasText("\"humidity\":50.00"));
+
+  // Waiting on the response doesn't hold up the caller, which reads it as it
+  // arrives
+  testHarness.post_stats(readings, 0, 0, 0);
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Len");
+  testHarness.post_stats(readings, 0, 0, 0);
+  SetGlobalInputStream("gth: 2\r\n\r\nok");
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("stop") == 0);
+
+  // So the next post can go out on the same connection
+  ClearGlobalNetLog();
+  stamp_readings(readings, 20);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("T00:00:20"));
+  assert(MockClient->Called("connect") == 1);
+
+  // A server that stops answering is given up on after the read timeout,
+  // without sending it the sample again
+  AdvanceGlobalMillis(STATS_READ_TIMEOUT - 1);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("stop") == 0);
+  AdvanceGlobalMillis(1);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("stop") == 1);
+  assert(MockClient->Called("connect") == 1);
+  assert(LittleFS.files["/spool_0"].size() == sizeof(StatsEntry));
+}
+
+void
+test_resolves_without_blocking()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 0,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+  LittleFS.files.clear();
+  testHarness.init(&config, update_url);
+
+  MockLib* MockClient = GetMock("WiFiClient");
+  assert(MockClient != NULL);
+  MockClient->Reset();
+  MockLib* MockDns = GetMock("dns");
+  assert(MockDns != NULL);
+  MockDns->Reset();
+  MockLib* Arduino = GetMock("MockArduino");
+  assert(Arduino != NULL);
+  Arduino->Reset();
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 50.0 },
+    .air_temp = { .error = SENSOR_OK, .value = 20.0 },
+  };
+
+  // The lookup goes on in the background, and is given up on if it's never
+  // answered
+  bool boolf = false;
+  int in_progress = ERR_INPROGRESS;
+  MockClient->Returns("connected", 1, &boolf);
+  MockDns->Returns("gethostbyname", 1, &in_progress);
+  SetGlobalInputStream("");
+  stamp_readings(readings, 10);
+  testHarness.post_stats(readings, 0, 0, 0);
+  AdvanceGlobalMillis(STATS_RESOLVE_TIMEOUT - 1);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockDns->Called("gethostbyname") == 1);
+  assert(LittleFS.files["/spool_0"].size() == 0);
+  AdvanceGlobalMillis(1);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LittleFS.files["/spool_0"].size() == sizeof(StatsEntry));
+  assert(MockClient->Called("connect") == 0);
+
+  // There's no connection until the lookup is answered
+  MockClient->Returns("connected", 1, &boolf);
+  MockDns->Returns("gethostbyname", 1, &in_progress);
+  stamp_readings(readings, 30);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockDns->Called("gethostbyname") == 2);
+  assert(MockClient->Called("connect") == 0);
+
+  // Connecting is kept short, since it can't be done without waiting
+  unsigned long timeout = STATS_CONNECT_TIMEOUT;
+  MockClient->Expects("setTimeout.arg_1", 1, &timeout);
+  FinishDnsLookup(0x0100007f);
+  ClearGlobalNetLog();
+  respond_ok();
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(MockClient->Called("connect") == 1);
+  assert(LogHasText("POST /statsendpoint"));
+  assert(Arduino->Called("delay") == 0);
+}
+
+void
+test_posts_batches()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 0,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+        .stats_batch_size = 3,
+    };
+  LittleFS.files.clear();
+  Url update_url = { .set = false };
+  testHarness.init(&config, update_url);
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 50.0 },
+    .air_temp = { .error = SENSOR_OK, .value = 20.0 },
+  };
+
+  // Samples are held until there are enough for a batch
+  ClearGlobalNetLog();
+  for (int t = 10; t <= 20; t += 5) {
+    stamp_readings(readings, t);
+    testHarness.post_stats(readings, 0, 0, t);
+  }
+  assert(!LogHasText("POST"));
+
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 30);
+  testHarness.post_stats(readings, 0, 0, 30);
+  assert(LogHasText("POST"));
+  assert(LogHasText("[{\"id\":"));
+  assert(LogHasText("\"analog\":10},{\"id\":"));
+  assert(LogHasText("\"analog\":20},{\"id\":"));
+  assert(LogHasText("\"analog\":30,\"agg\":{\"humidity\":[4,"));
+  assert(LogHasText("}]"));
+
+  // A partial batch goes out once its oldest sample is old enough
+  config.stats_batch_size = 5;
+  config.stats_batch_seconds = 15;
+  ClearGlobalNetLog();
+  for (int t = 40; t <= 50; t += 10) {
+    stamp_readings(readings, t);
+    testHarness.post_stats(readings, 0, 0, t);
+  }
+  assert(!LogHasText("POST"));
+  SetGlobalInputStream("HTTP/1.1 503 Unavailable\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 60);
+  testHarness.post_stats(readings, 0, 0, 60);
+  assert(LogHasText("[{\"id\":"));
+  assert(LogHasText("\"analog\":40},"));
+  assert(LogHasText("\"analog\":60,"));
+
+  // Samples the server didn't take are sent again with the next one
+  ClearGlobalNetLog();
+  SetGlobalInputStream("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  stamp_readings(readings, 70);
+  testHarness.post_stats(readings, 0, 0, 70);
+  assert(LogHasText("[{\"id\":"));
+  assert(LogHasText("\"analog\":40},"));
+  assert(LogHasText("\"analog\":70,"));
+
+  // When the server is down for long, the oldest samples are spooled
+  config.stats_batch_size = 10;
+  config.stats_batch_seconds = 0;
+  SetGlobalInputStream("HTTP/1.1 503 Unavailable\r\nContent-Length: 0\r\n\r\n");
+  for (int t = 80; t < 80 + 10 * STATS_BATCH_CAPACITY; t += 10) {
+    stamp_readings(readings, t);
+    testHarness.post_stats(readings, 0, 0, t);
+  }
+  ClearGlobalNetLog();
+  stamp_readings(readings, 200);
+  testHarness.post_stats(readings, 0, 0, 200);
+  assert(LogHasText("POST"));
+  assert(!LogHasText("T00:01:20"));
+  assert(LogHasText("[{\"id\":"));
+  assert(LogHasText("\"timestamp\":\"1970-01-01T00:01:30\""));
+  assert(LogHasText("\"analog\":200,"));
+  std::string& spooled = LittleFS.files["/spool_0"];
+  assert(spooled.size() == sizeof(StatsEntry));
+  assert(((StatsEntry*)spooled.data())->timestamp == 80);
+}
+
+void
+test_spools_undelivered_samples()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 0,
+        .sample_interval = 1,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+  LittleFS.files.clear();
+  testHarness.init(&config, update_url);
+
+  MockLib* MockClient = GetMock("WiFiClient");
+  assert(MockClient != NULL);
+  MockClient->Reset();
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 50.0 },
+    .air_temp = { .error = SENSOR_OK, .value = 20.0 },
+  };
+
+  // Samples that can't be sent are spooled, and sending moves on
+  bool boolf = false;
+  for (int t = 10; t <= 80; t += 10) {
+    MockClient->Returns("connected", 1, &boolf);
+    MockClient->Returns("connect", 1, &boolf);
+    stamp_readings(readings, t);
+    testHarness.post_stats(readings, 0, 0, 0);
+    stamp_readings(readings, t + 5);
+    testHarness.post_stats(readings, 0, 0, 0);
+  }
+  // Backing off longer after each failed connection
+  assert(MockClient->Called("connect") == 4);
+  assert(LittleFS.files["/spool_0"].size() == 8 * sizeof(StatsEntry));
+  MockClient->Reset();
+
+  // Once the server is back, a bounded batch follows the live post
+  ClearGlobalNetLog();
+  MockClient->Returns("connected", 1, &boolf);
+  respond_ok();
+  stamp_readings(readings, 90);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("T00:01:30"));
+  assert(!LogHasText("[{\"id\":"));
+  ClearGlobalNetLog();
+  respond_ok();
+  stamp_readings(readings, 91);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("[{\"id\":"));
+  assert(LogHasText("T00:00:10"));
+  assert(LogHasText("T00:01:00"));
+  assert(!LogHasText("T00:01:10"));
+  assert(LittleFS.files["/spool_0"].size() == 8 * sizeof(StatsEntry));
+
+  // The rest go out between live posts
+  ClearGlobalNetLog();
+  respond_ok();
+  stamp_readings(readings, 92);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(!LogHasText("POST"));
+  stamp_readings(readings, 91 + SPOOL_DRAIN_SECONDS);
+  testHarness.post_stats(readings, 0, 0, 0);
+  assert(LogHasText("T00:01:10"));
+  assert(LogHasText("T00:01:20"));
+  assert(!LittleFS.exists("/spool_0"));
+}
+
+void
+test_drops_stale_readings()
+{
+  Network testHarness = Network();
+  VivariumMonitorConfig config = {
+        .has_sht_sensor = true,
+        .num_therm_sensors = 1,
+        .sample_interval = 2,
+        .therm_interval = 60,
+        .stats_url = {
+            .host = "test.com",
+            .path = "/statsendpoint",
+            .port = 5883,
+            .set = true,
+        },
+        .stats_interval = 10,
+    };
+  Url update_url = { .set = false };
+
+  // Init the library
+  testHarness.init(&config, update_url);
+
+  SensorData readings = {
+    .humidity = { .error = SENSOR_OK, .value = 54.6 },
+    .air_temp = { .error = SENSOR_OK, .value = 22.34 },
+    .high_temp = { .error = SENSOR_OK, .value = 25.0 },
+    .low_temp = { .error = SENSOR_OK, .value = 20.0 },
+    .probes = {
+      { .error = SENSOR_OK, .value = 22.5 },
+    },
+    .num_probes = 1,
+    .timestamp = 100,
+  };
+  stamp_readings(readings, 100);
+
+  // The SHT40 hasn't been measured in 3 of its intervals, but the probes
+  // are still within theirs
+  readings.humidity.timestamp = 93;
+  readings.air_temp.timestamp = 93;
+  readings.high_temp.timestamp = 50;
+  readings.low_temp.timestamp = 50;
+  readings.probes[0].timestamp = 50;
+  ClearGlobalNetLog();
+  testHarness.post_stats(readings, 0, 1, 36);
+  assert(LogHasText("POST"));
+  assert(LogHasText("\"humidity\":null"));
+  assert(LogHasText("\"air_temp\":null"));
+  assert(LogHasText("\"high_temp\":25.00"));
+  assert(LogHasText("\"low_temp\":20.00"));
+  assert(LogHasText("\"probes\":[22.50]"));
+}
+
 void
 test_no_post_if_not_configured()
 {
@@ -179,12 +929,13 @@ test_no_post_if_not_configured()
   testHarness.init(&config, update_url);
 
   SensorData readings = {
-    .humidity = { .has_error = false, .value = 54.6 },
-    .air_temp = { .has_error = false, .value = 22.34 },
-    .high_temp = { .has_error = false, .value = 25.0 },
-    .low_temp = { .has_error = false, .value = 20.0 },
+    .humidity = { .error = SENSOR_OK, .value = 54.6 },
+    .air_temp = { .error = SENSOR_OK, .value = 22.34 },
+    .high_temp = { .error = SENSOR_OK, .value = 25.0 },
+    .low_temp = { .error = SENSOR_OK, .value = 20.0 },
     .timestamp = 20,
   };
+  stamp_readings(readings, 20);
 
   // Check we don't past any data
   ClearGlobalNetLog();
@@ -220,6 +971,16 @@ main(void)
   test_sends_nulls(testHarness);
 
   // Run standalone tests
+  test_posts_each_probe();
+  test_posts_bus_health();
+  test_posts_running_stats();
+  test_keeps_connection_open();
+  test_keeps_chunked_connection_open();
+  test_posts_without_blocking();
+  test_resolves_without_blocking();
+  test_posts_batches();
+  test_spools_undelivered_samples();
+  test_drops_stale_readings();
   test_no_post_if_not_configured();
   return 0;
 }
@@ -1,4 +1,6 @@
+#include <Arduino.h>
 #include <Hardware.h>
+#include <I2CBus.h>
 #include <MockLib.h>
 #include <cassert>
 
@@ -41,18 +43,86 @@ test_humidity_sensor_read()
   int cmd = 0xFD;
   MockWireLib->Expects("write.arg_1", 1, &cmd);
 
-  // Call read_sensors
+  // Call read_sensors, which should only send the command
   SensorData results = testHarness.read_sensors(20);
   assert(MockWireLib->Called("write") == 1);
+  assert(MockWireLib->Called("requestFrom") == 0);
+  assert(results.timestamp == 0);
+  assert(results.humidity.error != SENSOR_OK);
+
+  // Make sure we don't read before the measurement is done
+  results = testHarness.read_sensors(20);
+  assert(MockWireLib->Called("requestFrom") == 0);
+  assert(results.timestamp == 0);
+
+  // Let the measurement finish and collect it
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(20);
+  assert(MockWireLib->Called("write") == 1);
+  assert(MockWireLib->Called("requestFrom") == 1);
 
   // Check our results
   assert(results.timestamp == 20);
-  assert(results.air_temp.has_error == false);
+  assert(results.air_temp.error == SENSOR_OK);
   assert(results.air_temp.value < 20.5 && results.air_temp.value > 19.5);
-  assert(results.humidity.has_error == false);
+  assert(results.humidity.error == SENSOR_OK);
+  assert(results.humidity.value < 50.5 && results.humidity.value > 49.5);
+  assert(results.humidity.timestamp == 20);
+  assert(results.air_temp.timestamp == 20);
+  assert(results.high_temp.error != SENSOR_OK);
+  assert(results.low_temp.error != SENSOR_OK);
+  assert(results.high_temp.timestamp == 0);
+}
+
+void
+test_humidity_sensor_precision()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = true,
+    .sht_precision = SHT_PRECISION_LOW,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+  };
+
+  // Get mock global Wire obj
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  MockWireLib->Reset();
+  testHarness.init(&config);
+
+  // Check sent command
+  int cmd = 0xE0;
+  MockWireLib->Expects("write.arg_1", 1, &cmd);
+  SensorData results = testHarness.read_sensors(20);
+  assert(MockWireLib->Called("write") == 1);
+
+  // Set up sensor response
+  int six = 6;
+  MockWireLib->Returns("requestFrom", 1, &six);
+  uint8_t bytes[6];
+  bytes[5] = 0x5F;
+  bytes[4] = 0x15;
+  bytes[3] = 0x49;
+  bytes[2] = 0x72;
+  bytes[1] = 0xAF;
+  bytes[0] = 0xB1;
+  MockWireLib->Returns(
+    "read", 6, bytes, bytes + 1, bytes + 2, bytes + 3, bytes + 4, bytes + 5);
+
+  // The wait should match the low precision measurement
+  AdvanceGlobalMillis(SHT40_READ_LOW_DELAY - 1);
+  results = testHarness.read_sensors(20);
+  assert(MockWireLib->Called("requestFrom") == 0);
+  AdvanceGlobalMillis(1);
+  results = testHarness.read_sensors(20);
+  assert(MockWireLib->Called("requestFrom") == 1);
+
+  assert(results.timestamp == 20);
+  assert(results.air_temp.error == SENSOR_OK);
+  assert(results.air_temp.value < 20.5 && results.air_temp.value > 19.5);
+  assert(results.humidity.error == SENSOR_OK);
   assert(results.humidity.value < 50.5 && results.humidity.value > 49.5);
-  assert(results.high_temp.has_error == true);
-  assert(results.low_temp.has_error == true);
 }
 
 void
@@ -71,29 +141,372 @@ test_therm_sensors_read()
 
   // Initialize the hardware, make sure thermometers are set up
   int three = 3;
+  bool boolt = true;
   MockTherm->Returns("getDeviceCount", 1, &three);
+  MockTherm->Returns("getAddress", 3, &boolt, &boolt, &boolt);
 
   testHarness.init(&config);
   assert(MockTherm->Called("begin") == 1);
   assert(MockTherm->Called("setResolution") == 1);
+  assert(MockTherm->Called("getAddress") == 3);
 
   // Set up sensor response
-  bool boolt = true;
-  MockTherm->Returns("getAddress", 3, &boolt, &boolt, &boolt);
   float t1 = 11.0, t2 = 14.0, t3 = 18.0;
   MockTherm->Returns("getTempC", 3, &t2, &t1, &t3);
 
-  // Call read_sensors
+  // Call read_sensors, make sure addresses aren't looked up again
   SensorData results = testHarness.read_sensors(20);
+  assert(MockTherm->Called("getAddress") == 3);
 
   // Check our results
   assert(results.timestamp == 20);
-  assert(results.high_temp.has_error == false);
+  assert(results.high_temp.error == SENSOR_OK);
   assert(results.high_temp.value < 18.5 && results.high_temp.value > 17.5);
-  assert(results.low_temp.has_error == false);
+  assert(results.low_temp.error == SENSOR_OK);
+  assert(results.low_temp.value < 11.5 && results.low_temp.value > 10.5);
+  assert(results.air_temp.error != SENSOR_OK);
+  assert(results.humidity.error != SENSOR_OK);
+}
+
+void
+test_therm_sensors_multiple_buses()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 3,
+    .sample_interval = 1,
+    .num_one_wire_buses = 2,
+    .one_wire_pins = { 2, 14 },
+    .one_wire_probes = { 1, 2 },
+  };
+
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+  MockLib* MockTherm1 = GetMock("DallasTemperature1");
+  assert(MockTherm1 != NULL);
+  MockTherm1->Reset();
+
+  // Neither bus blocks on its own
+  int one = 1, two = 2;
+  bool boolf = false;
+  MockTherm->Returns("getDeviceCount", 1, &one);
+  MockTherm->Expects("setWaitForConversion.arg_1", 1, &boolf);
+  MockTherm1->Returns("getDeviceCount", 1, &two);
+  MockTherm1->Expects("setWaitForConversion.arg_1", 1, &boolf);
+  testHarness.init(&config);
+  assert(MockTherm->Called("getAddress") == 1);
+  assert(MockTherm1->Called("getAddress") == 2);
+
+  // Conversions are started on both buses, waited out together, and merged
+  // in bus order
+  MockLib* Arduino = GetMock("MockArduino");
+  assert(Arduino != NULL);
+  Arduino->Reset();
+  int wait = CONVERSION_TIME(9); // Finest that fits in 1s when blocking
+  Arduino->Expects("delay.arg_1", 1, &wait);
+  float t1 = 11.0, t2 = 14.0, t3 = 18.0;
+  MockTherm->Returns("getTempC", 1, &t1);
+  MockTherm1->Returns("getTempC", 2, &t3, &t2);
+  SensorData results = testHarness.read_sensors(20);
+  assert(MockTherm->Called("requestTemperatures") == 1);
+  assert(MockTherm1->Called("requestTemperatures") == 1);
+  assert(Arduino->Called("delay") == 1);
+
+  assert(results.timestamp == 20);
+  assert(results.num_probes == 3);
+  assert(results.probes[0].value < 11.5 && results.probes[0].value > 10.5);
+  assert(results.probes[1].value < 14.5 && results.probes[1].value > 13.5);
+  assert(results.probes[2].value < 18.5 && results.probes[2].value > 17.5);
+  assert(results.high_temp.value < 18.5 && results.high_temp.value > 17.5);
+  assert(results.low_temp.value < 11.5 && results.low_temp.value > 10.5);
+}
+
+void
+test_therm_sensors_hotplug()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 1,
+    .sample_interval = 3600,
+  };
+
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+  int one = 1, two = 2;
+  MockTherm->Returns("getDeviceCount", 1, &one);
+  testHarness.init(&config);
+  testHarness.read_sensors(20);
+  assert(MockTherm->Called("begin") == 1);
+  assert(MockTherm->Called("getAddress") == 1);
+
+  // Samples in between don't touch the bus
+  testHarness.read_sensors(21);
+  testHarness.read_sensors(20 + HOTPLUG_CHECK_INTERVAL - 1);
+  assert(MockTherm->Called("begin") == 1);
+  assert(MockTherm->Called("getAddress") == 1);
+
+  // A probe plugged in gets its own channel
+  MockTherm->Returns("getDeviceCount", 1, &two);
+  SensorData results = testHarness.read_sensors(20 + HOTPLUG_CHECK_INTERVAL);
+  assert(MockTherm->Called("begin") == 2);
+  assert(MockTherm->Called("getAddress") == 3);
+  assert(config.num_therm_sensors == 2);
+  assert(results.num_probes == 2);
+  assert(results.probes[1].error == SENSOR_NOT_READ);
+  assert(testHarness.bus_health()->probe_changes == 1);
+
+  // The next check finds nothing new
+  MockTherm->Returns("getDeviceCount", 1, &two);
+  testHarness.read_sensors(20 + 2 * HOTPLUG_CHECK_INTERVAL);
+  assert(MockTherm->Called("getAddress") == 5);
+  assert(testHarness.bus_health()->probe_changes == 1);
+
+  // A probe that was unplugged is reported
+  bool boolf = false;
+  MockTherm->Returns("getAddress", 1, &boolf);
+  MockTherm->Returns("getDeviceCount", 1, &one);
+  testHarness.read_sensors(20 + 3 * HOTPLUG_CHECK_INTERVAL);
+  assert(config.num_therm_sensors == 2);
+  assert(testHarness.bus_health()->probe_changes == 2);
+}
+
+void
+test_therm_sensors_keep_channels()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 3,
+    .sample_interval = 3600,
+  };
+
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+
+  // The probe found first on the bus was pinned to the last channel
+  byte first[8] = { 0x28, 0 }, second[8] = { 0x28, 1 };
+  byte third[8] = { 0x28, 2 };
+  ProbeMap* channels = testHarness.probe_map();
+  channels->clear();
+  channels->assign(2, first, "basking");
+  channels->assign(0, second);
+  assert(channels->slot("basking") == 2);
+  assert(channels->slot(second) == 0);
+
+  int three = 3;
+  MockTherm->Returns("getDeviceCount", 1, &three);
+  testHarness.init(&config);
+
+  // The new probe takes the free channel, and gets pinned there too
+  assert(channels->slot(third) == 1);
+  assert(channels->changed());
+
+  // Channels are read with their own probe
+  int idx0 = 0, idx1 = 1, idx2 = 2;
+  float t1 = 11.0, t2 = 14.0, t3 = 18.0;
+  MockTherm->Expects("getTempC.index", 3, &idx0, &idx2, &idx1);
+  MockTherm->Returns("getTempC", 3, &t3, &t2, &t1);
+  SensorData results = testHarness.read_sensors(20);
+  assert(results.num_probes == 3);
+  assert(results.probes[0].value < 11.5 && results.probes[0].value > 10.5);
+  assert(results.probes[2].value < 18.5 && results.probes[2].value > 17.5);
+
+  // A probe unplugged for good gives its channel to its replacement
+  byte replacement[8] = { 0x28, 7 };
+  MockTherm->Expects("getAddress.buffer", 3, replacement, third, first);
+  testHarness.read_sensors(20 + HOTPLUG_CHECK_INTERVAL);
+  assert(channels->slot(first) == 2);
+  assert(channels->slot(replacement) == 0);
+  assert(channels->slot(second) == -1);
+}
+
+void
+test_therm_resolution()
+{
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 1,
+    .sample_interval = 2,
+  };
+
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+
+  // Waits cover the datasheet's 93.75ms and 187.5ms, and a short millis()
+  assert(CONVERSION_TIME(9) == 95);
+  assert(CONVERSION_TIME(10) == 189);
+  assert(CONVERSION_TIME(12) == 751);
+
+  // Blocking conversions only get a small part of the interval
+  int res = 10;
+  Hardware blocking = Hardware();
+  MockTherm->Expects("setResolution.arg_1", 1, &res);
+  blocking.init(&config);
+  assert(MockTherm->Called("setResolution") == 1);
+
+  // Async conversions can use more of it
+  int async_res = 12;
+  Hardware async = Hardware();
+  config.async_temp_reads = true;
+  MockTherm->Expects("setResolution.arg_1", 1, &async_res);
+  async.init(&config);
+  assert(MockTherm->Called("setResolution") == 2);
+
+  // Short intervals drop to the lowest resolution
+  int low_res = 9;
+  Hardware fast = Hardware();
+  config.async_temp_reads = false;
+  config.sample_interval = 1;
+  MockTherm->Expects("setResolution.arg_1", 1, &low_res);
+  fast.init(&config);
+  assert(MockTherm->Called("setResolution") == 3);
+
+  // A configured resolution is used as-is
+  int set_res = 11;
+  Hardware configured = Hardware();
+  config.temp_resolution = 11;
+  MockTherm->Expects("setResolution.arg_1", 1, &set_res);
+  configured.init(&config);
+  assert(MockTherm->Called("setResolution") == 4);
+}
+
+void
+test_therm_sensors_rescan()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 2,
+    .sample_interval = 1,
+  };
+
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+
+  int two = 2;
+  MockTherm->Returns("getDeviceCount", 1, &two);
+  testHarness.init(&config);
+  assert(MockTherm->Called("getAddress") == 2);
+
+  // Have a sensor stop responding
+  float t1 = 11.0, t2 = -127.0;
+  MockTherm->Returns("getTempC", 2, &t2, &t1);
+  SensorData results = testHarness.read_sensors(20);
+  assert(results.timestamp == 0);
+
+  assert(testHarness.bus_health()->onewire.transactions == 2);
+  assert(testHarness.bus_health()->onewire.failures[0] == 1);
+
+  // The sensors are looked for again right away, and read again
+  assert(MockTherm->Called("getAddress") == 4);
+  assert(MockTherm->Called("requestTemperatures") == 2);
+  t2 = 14.0;
+  MockTherm->Returns("getTempC", 2, &t2, &t1);
+  results = testHarness.read_sensors(20);
+  assert(results.timestamp == 20);
+  assert(results.probes[1].error == SENSOR_OK);
+  assert(results.high_temp.error == SENSOR_OK);
+  assert(results.high_temp.value < 14.5 && results.high_temp.value > 13.5);
+
+  // Once everything is good, addresses come from the cache again
+  results = testHarness.read_sensors(22);
+  assert(MockTherm->Called("getAddress") == 4);
+}
+
+void
+test_therm_sensors_missing_not_retried()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 2,
+    .sample_interval = 1,
+  };
+
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+
+  // Only one of the two sensors is there
+  int one = 1;
+  bool boolt = true, boolf = false;
+  MockTherm->Returns("getDeviceCount", 1, &one);
+  MockTherm->Returns("getAddress", 2, &boolf, &boolt);
+  testHarness.init(&config);
+  assert(MockTherm->Called("getAddress") == 2);
+
+  // Each sample converts once, and doesn't search for the missing sensor
+  float t1 = 11.0;
+  for (int i = 0; i < 5; i++) {
+    MockTherm->Returns("getTempC", 1, &t1);
+    SensorData results = testHarness.read_sensors(20 + i);
+    assert(results.timestamp == 20 + i);
+    assert(results.probes[0].error == SENSOR_OK);
+    assert(results.probes[1].error == SENSOR_MISSING);
+    assert(MockTherm->Called("requestTemperatures") == i + 1);
+    assert(MockTherm->Called("getAddress") == 2);
+  }
+}
+
+void
+test_therm_sensors_async_read()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 3,
+    .sample_interval = 1,
+    .async_temp_reads = true,
+    .temp_resolution = 12,
+  };
+
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+
+  // Initialize the hardware, make sure conversions won't block
+  int three = 3;
+  bool boolf = false;
+  MockTherm->Returns("getDeviceCount", 1, &three);
+  MockTherm->Expects("setWaitForConversion.arg_1", 1, &boolf);
+  testHarness.init(&config);
+  assert(MockTherm->Called("setWaitForConversion") == 1);
+
+  // Set up sensor response
+  float t1 = 11.0, t2 = 14.0, t3 = 18.0;
+  MockTherm->Returns("getTempC", 3, &t2, &t1, &t3);
+
+  // First call should only start the conversion
+  SensorData results = testHarness.read_sensors(20);
+  assert(MockTherm->Called("requestTemperatures") == 1);
+  assert(MockTherm->Called("getTempC") == 0);
+  assert(results.timestamp == 0);
+  assert(results.high_temp.error != SENSOR_OK);
+
+  // Nothing is collected until the conversion time has passed
+  AdvanceGlobalMillis(CONVERSION_TIME(12) - 1);
+  results = testHarness.read_sensors(20);
+  assert(MockTherm->Called("getTempC") == 0);
+  assert(results.timestamp == 0);
+
+  AdvanceGlobalMillis(1);
+  results = testHarness.read_sensors(21);
+  assert(MockTherm->Called("requestTemperatures") == 1);
+  assert(MockTherm->Called("getTempC") == 3);
+
+  // Check our results
+  assert(results.timestamp == 21);
+  assert(results.high_temp.error == SENSOR_OK);
+  assert(results.high_temp.value < 18.5 && results.high_temp.value > 17.5);
+  assert(results.low_temp.error == SENSOR_OK);
   assert(results.low_temp.value < 11.5 && results.low_temp.value > 10.5);
-  assert(results.air_temp.has_error == true);
-  assert(results.humidity.has_error == true);
 }
 
 void
@@ -128,18 +541,130 @@ test_i2c_bus_error_handling()
 
   // Make sure i2c bus is reset
   assert(Arduino->Called("pinMode") >= 2);
+  assert(testHarness.bus_health()->i2c.resets == 1);
+  assert(testHarness.bus_health()->i2c.failures[4] == 1);
 
   // Check our results
-  assert(results.air_temp.has_error == true);
-  assert(results.humidity.has_error == true);
+  assert(results.air_temp.error != SENSOR_OK);
+  assert(results.humidity.error != SENSOR_OK);
 
-  // Test incomplete read fails
+  // The read is tried again once the bus has had time to recover
+  int zero = 0;
+  MockWireLib->Returns("endTransmission", 1, &zero);
+  AdvanceGlobalMillis(BUS_ERROR_BACKOFF - 1);
+  testHarness.read_sensors(20);
+  assert(MockWireLib->Called("write") == 1);
+  AdvanceGlobalMillis(1);
+  testHarness.read_sensors(20);
+  assert(MockWireLib->Called("write") == 2);
+
+  // Test incomplete read fails, even after retrying it
   MockWireLib->Returns("requestFrom", 1, &four);
-  results = testHarness.read_sensors(21);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(20);
+  assert(results.timestamp == 0);
+  assert(MockWireLib->Called("write") == 3);
+  MockWireLib->Returns("requestFrom", 1, &four);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(20);
 
   assert(results.timestamp == 0);
-  assert(results.air_temp.has_error == true);
-  assert(results.humidity.has_error == true);
+  assert(results.air_temp.error == SENSOR_SHORT_READ);
+  assert(results.humidity.error == SENSOR_SHORT_READ);
+  assert(testHarness.bus_health()->i2c.failures[0] == 2);
+}
+
+void
+test_i2c_bus_recovery_does_not_block()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = true,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+  };
+
+  // Get mock global Wire obj
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  MockWireLib->Reset();
+  testHarness.init(&config);
+
+  MockLib* Arduino = GetMock("MockArduino");
+  assert(Arduino != NULL);
+  Arduino->Reset();
+
+  // SCL starts high, SDA is held low, then SCL gets stretched after a clock
+  int four = 4;
+  uint8_t high = HIGH, low = LOW;
+  MockWireLib->Returns("endTransmission", 1, &four);
+  Arduino->Returns("digitalRead", 3, &low, &low, &high);
+  SensorData results = testHarness.read_sensors(20);
+  assert(results.air_temp.error != SENSOR_OK);
+  assert(MockWireLib->Called("begin") == 1);
+
+  // While SCL is held low, the bus shouldn't be touched and nothing waits
+  testHarness.set_analog(50);
+  testHarness.write_outputs();
+  assert(MockWireLib->Called("write") == 1);
+  assert(MockWireLib->Called("begin") == 1);
+  assert(Arduino->Called("delay") == 0);
+
+  // Release SCL and SDA, the bus should be handed back to Wire
+  Arduino->Returns("digitalRead", 2, &high, &high);
+  testHarness.write_outputs();
+  assert(MockWireLib->Called("begin") == 2);
+  assert(MockWireLib->Called("write") == 3);
+  assert(Arduino->Called("delay") == 0);
+}
+
+void
+test_i2c_clock_fallback()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = true,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+  };
+
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  MockWireLib->Reset();
+
+  // The bus runs at the standard speed unless asked to go faster
+  uint32_t standard = I2C_STANDARD_CLOCK;
+  MockWireLib->Expects("setClock.arg_1", 1, &standard);
+  testHarness.init(&config);
+  assert(MockWireLib->Called("setClock") == 1);
+
+  // The fast clock has to be asked for, and clock stretching is limited
+  uint32_t fast = I2C_FAST_CLOCK, limit = I2C_STRETCH_LIMIT;
+  config.i2c_clock = I2C_FAST_CLOCK;
+  MockWireLib->Reset();
+  MockWireLib->Expects("setClock.arg_1", 1, &fast);
+  MockWireLib->Expects("setClockStretchLimit.arg_1", 1, &limit);
+  testHarness.init(&config);
+  assert(MockWireLib->Called("setClock") == 1);
+  assert(MockWireLib->Called("setClockStretchLimit") == 1);
+
+  // A data NACK is retried right away by the bus
+  int three = 3;
+  MockWireLib->Returns("endTransmission", 3, &three, &three, &three);
+  SensorData results = testHarness.read_sensors(20);
+  assert(MockWireLib->Called("endTransmission") == 2);
+  assert(results.humidity.error != SENSOR_OK);
+  assert(testHarness.bus_health()->i2c.failures[3] == 2);
+
+  // Too many errors in a row drop the bus to the standard speed
+  MockWireLib->Expects("setClock.arg_1", 1, &standard);
+  AdvanceGlobalMillis(BUS_ERROR_BACKOFF);
+  testHarness.read_sensors(20);
+  assert(MockWireLib->Called("setClock") == 2);
+
+  // The bus's own retry then goes through at the slower speed
+  assert(MockWireLib->Called("endTransmission") == 4);
+  assert(testHarness.bus_health()->i2c.failures[3] == 3);
 }
 
 void
@@ -176,23 +701,50 @@ test_sht40_crc_fails()
     "read", 6, bytes, bytes + 1, bytes + 2, bytes + 3, bytes + 4, bytes + 5);
 
   // Call read_sensors
+  testHarness.read_sensors(20);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
   SensorData results = testHarness.read_sensors(20);
 
+  // The bad checksum holds the sample back, and a retry is sent right away
+  assert(results.timestamp == 0);
+  assert(MockWireLib->Called("write") == 2);
+
+  // The retry recovers the reading
+  bytes[2] = 0x72;
+  MockWireLib->Returns("requestFrom", 1, &six);
+  MockWireLib->Returns(
+    "read", 6, bytes, bytes + 1, bytes + 2, bytes + 3, bytes + 4, bytes + 5);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(20);
+
   // Check our results
   assert(results.timestamp == 20);
-  assert(results.air_temp.has_error == false);
+  assert(results.air_temp.error == SENSOR_OK);
   assert(results.air_temp.value < 20.5 && results.air_temp.value > 19.5);
-  assert(results.humidity.has_error == true);
+  assert(results.humidity.error == SENSOR_OK);
+  assert(results.humidity.value < 50.5 && results.humidity.value > 49.5);
 
-  // Now try with both failing
+  // Now try with both failing on every try
+  bytes[2] = 0x73;
   bytes[5] = 0x5E;
-  MockWireLib->Returns(
-    "read", 6, bytes, bytes + 1, bytes + 2, bytes + 3, bytes + 4, bytes + 5);
-  MockWireLib->Returns("requestFrom", 1, &six);
-  results = testHarness.read_sensors(21);
+  testHarness.read_sensors(21);
+  for (int i = 0; i <= CRC_ERROR_RETRIES; i++) {
+    MockWireLib->Returns(
+      "read", 6, bytes, bytes + 1, bytes + 2, bytes + 3, bytes + 4, bytes + 5);
+    MockWireLib->Returns("requestFrom", 1, &six);
+    AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+    results = testHarness.read_sensors(21);
+  }
+  assert(MockWireLib->Called("write") == 3 + CRC_ERROR_RETRIES);
   assert(results.timestamp == 20);
-  assert(results.air_temp.has_error == true);
-  assert(results.humidity.has_error == true);
+  assert(results.air_temp.error == SENSOR_CRC_ERROR);
+  assert(results.humidity.error == SENSOR_CRC_ERROR);
+
+  // Check the failures were counted
+  const BusHealth* health = testHarness.bus_health();
+  assert(health->i2c.transactions == 2 * (3 + CRC_ERROR_RETRIES));
+  assert(health->i2c.crc_failures == 1 + 2 * (1 + CRC_ERROR_RETRIES));
+  assert(health->i2c.failures[0] == 0);
 }
 
 void
@@ -215,19 +767,158 @@ test_temp_sensor_bad_value()
   testHarness.init(&config);
 
   // Set up sensor response
-  bool boolt = true;
-  MockTherm->Returns("getAddress", 2, &boolt, &boolt);
-  float t1 = 11.0, t2 = -180.0;
-  MockTherm->Returns("getTempC", 2, &t2, &t1);
+  float t1 = 11.0, t2 = -180.0, t3 = 15.0;
+  MockTherm->Returns("getTempC", 3, &t3, &t2, &t1);
 
-  // Call read_sensors
+  // Call read_sensors, the bad sensor gets a rescan and another try
+  SensorData results = testHarness.read_sensors(20);
+  assert(results.timestamp == 0);
+  assert(MockTherm->Called("requestTemperatures") == 2);
+  MockTherm->Returns("getTempC", 3, &t3, &t2, &t1);
+  results = testHarness.read_sensors(20);
+
+  // Check that the bad sensor is left out
+  assert(results.timestamp == 20);
+  assert(results.num_probes == 3);
+  assert(results.probes[0].error == SENSOR_OK);
+  assert(results.probes[0].value < 11.5 && results.probes[0].value > 10.5);
+  assert(results.probes[1].error == SENSOR_MISSING);
+  assert(results.probes[2].error == SENSOR_OK);
+  assert(results.probes[2].value < 15.5 && results.probes[2].value > 14.5);
+  assert(results.high_temp.error == SENSOR_OK);
+  assert(results.high_temp.value < 15.5 && results.high_temp.value > 14.5);
+  assert(results.low_temp.error == SENSOR_OK);
+  assert(results.low_temp.value < 11.5 && results.low_temp.value > 10.5);
+
+  // Now have all of them fail
+  t1 = -127.0;
+  t3 = -127.0;
+  MockTherm->Returns("getTempC", 3, &t3, &t2, &t1);
+  testHarness.read_sensors(21);
+  MockTherm->Returns("getTempC", 3, &t3, &t2, &t1);
+  results = testHarness.read_sensors(21);
+  assert(results.timestamp == 20);
+  assert(results.probes[0].error != SENSOR_OK);
+  assert(results.probes[1].error != SENSOR_OK);
+  assert(results.probes[2].error != SENSOR_OK);
+  assert(results.high_temp.error != SENSOR_OK);
+  assert(results.low_temp.error != SENSOR_OK);
+}
+
+void
+test_temp_sensor_crc_error()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 2,
+    .sample_interval = 1,
+  };
+
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+
+  int two = 2;
   MockTherm->Returns("getDeviceCount", 1, &two);
+  testHarness.init(&config);
+  assert(MockTherm->Called("getAddress") == 2);
+
+  // A sensor that still answers had its data corrupted, and is read again
+  // right away without another conversion or scan
+  bool boolt = true;
+  float t1 = 11.0, t2 = 14.0, bad = -127.0;
+  MockTherm->Returns("getTempC", 3, &t2, &bad, &t1);
+  MockTherm->Returns("readScratchPad", 1, &boolt);
   SensorData results = testHarness.read_sensors(20);
+  assert(results.timestamp == 20);
+  assert(results.probes[1].error == SENSOR_OK);
+  assert(results.high_temp.value < 14.5 && results.high_temp.value > 13.5);
+  assert(MockTherm->Called("getTempC") == 3);
+  assert(MockTherm->Called("requestTemperatures") == 1);
+  assert(MockTherm->Called("getAddress") == 2);
+  assert(testHarness.bus_health()->onewire.crc_failures == 1);
+  assert(testHarness.bus_health()->onewire.failures[0] == 0);
+
+  // Data that stays corrupted is given up on after its retries
+  MockTherm->Returns("getTempC", 4, &bad, &bad, &bad, &t1);
+  MockTherm->Returns("readScratchPad", 3, &boolt, &boolt, &boolt);
+  results = testHarness.read_sensors(21);
+  assert(results.timestamp == 20);
+  results = testHarness.read_sensors(21);
+  assert(results.timestamp == 21);
+  assert(results.probes[0].error == SENSOR_OK);
+  assert(results.probes[1].error == SENSOR_CRC_ERROR);
+  assert(results.high_temp.value < 11.5 && results.high_temp.value > 10.5);
+  assert(MockTherm->Called("getTempC") == 3 + 1 + 1 + CRC_ERROR_RETRIES);
+  assert(MockTherm->Called("getAddress") == 2);
+  assert(testHarness.bus_health()->onewire.crc_failures ==
+         2 + CRC_ERROR_RETRIES);
+}
 
-  // Check our results
-  assert(results.timestamp == 0);
-  assert(results.high_temp.has_error == true);
-  assert(results.low_temp.has_error == true);
+/*
+ * Queues up an SHT40 response of 20C air temp and the given humidity bytes.
+ */
+void
+queue_sht40_response(MockLib* MockWireLib, uint8_t rh_msb, uint8_t rh_lsb,
+                     uint8_t rh_crc)
+{
+  // The mock holds on to pointers, so these need to outlive this call
+  static int zero = 0, six = 6;
+  static uint8_t bytes[6];
+  MockWireLib->Returns("endTransmission", 1, &zero);
+  MockWireLib->Returns("requestFrom", 1, &six);
+  bytes[5] = 0x5F;
+  bytes[4] = 0x15;
+  bytes[3] = 0x49;
+  bytes[2] = rh_msb;
+  bytes[1] = rh_lsb;
+  bytes[0] = rh_crc;
+  MockWireLib->Returns(
+    "read", 6, bytes, bytes + 1, bytes + 2, bytes + 3, bytes + 4, bytes + 5);
+}
+
+void
+test_sht40_error_while_bus_recovers()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = true,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+  };
+
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  testHarness.init(&config);
+  MockWireLib->Reset();
+  MockLib* Arduino = GetMock("MockArduino");
+  assert(Arduino != NULL);
+  Arduino->Reset();
+
+  // Start with a good reading
+  queue_sht40_response(MockWireLib, 0xC8, 0xB3, 0xF0);
+  testHarness.read_sensors(20);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  SensorData results = testHarness.read_sensors(20);
+  assert(results.air_temp.error == SENSOR_OK);
+
+  // An output write leaves SCL stretched, so the bus is still recovering
+  int four = 4;
+  uint8_t high = HIGH, low = LOW;
+  MockWireLib->Returns("endTransmission", 1, &four);
+  Arduino->Returns("digitalRead", 3, &low, &low, &high);
+  testHarness.set_analog(50);
+  testHarness.write_outputs();
+
+  // The next sample reports the bus error instead of the old reading
+  results = testHarness.read_sensors(21);
+  for (int i = 0; i < BUS_ERROR_RETRIES; i++) {
+    AdvanceGlobalMillis(BUS_ERROR_BACKOFF << i);
+    results = testHarness.read_sensors(21);
+  }
+  assert(results.air_temp.error == SENSOR_BUS_ERROR);
+  assert(results.humidity.error == SENSOR_BUS_ERROR);
 }
 
 void
@@ -248,60 +939,151 @@ test_sht40_does_heat()
   testHarness.init(&config);
   MockWireLib->Reset();
 
-  // Set up sensor response
-  int zero = 0;
-  MockWireLib->Returns("endTransmission", 1, &zero);
-  int six = 6;
-  MockWireLib->Returns("requestFrom", 1, &six);
-  uint8_t bytes[6];
-  bytes[5] = 0x5F;
-  bytes[4] = 0x15;
-  bytes[3] = 0x49;
-  bytes[2] = 0x72;
-  bytes[1] = 0xAF;
-  bytes[0] = 0xB1;
-  MockWireLib->Returns(
-    "read", 6, bytes, bytes + 1, bytes + 2, bytes + 3, bytes + 4, bytes + 5);
+  // Set up a humid sensor response
+  queue_sht40_response(MockWireLib, 0xC8, 0xB3, 0xF0);
 
   // Check sent command
   int cmd = 0xFD;
   MockWireLib->Expects("write.arg_1", 1, &cmd);
 
   // Call read_sensors
+  testHarness.read_sensors(20);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
   SensorData results = testHarness.read_sensors(20);
   assert(MockWireLib->Called("write") == 1);
 
   // Check our results
   assert(results.timestamp == 20);
-  assert(results.air_temp.has_error == false);
+  assert(results.air_temp.error == SENSOR_OK);
   assert(results.air_temp.value < 20.5 && results.air_temp.value > 19.5);
-  assert(results.humidity.has_error == false);
-  assert(results.humidity.value < 50.5 && results.humidity.value > 49.5);
+  assert(results.humidity.error == SENSOR_OK);
+  assert(results.humidity.value < 92.5 && results.humidity.value > 91.5);
+
+  // Humidity stays high, but not long enough to heat yet
+  queue_sht40_response(MockWireLib, 0xC8, 0xB3, 0xF0);
+  MockWireLib->Expects("write.arg_1", 1, &cmd);
+  testHarness.read_sensors(30);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(30);
+  assert(MockWireLib->Called("write") == 2);
+  assert(results.timestamp == 30);
 
   // Now fast-forward in time and engage heater
   cmd = 0x2F;
   MockWireLib->Expects("write.arg_1", 1, &cmd);
-
-  // Set up new sensor response
+  int zero = 0;
   MockWireLib->Returns("endTransmission", 1, &zero);
-  MockWireLib->Returns("requestFrom", 1, &six);
-  bytes[5] = 0x5F;
-  bytes[4] = 0x15;
-  bytes[3] = 0x49;
-  bytes[2] = 0x2E;
-  bytes[1] = 0x15;
-  bytes[0] = 0x15;
-  MockWireLib->Returns(
-    "read", 6, bytes, bytes + 1, bytes + 2, bytes + 3, bytes + 4, bytes + 5);
 
-  SensorData cached = testHarness.read_sensors(500);
-  assert(MockWireLib->Called("write") == 2);
+  SensorData cached = testHarness.read_sensors(400);
+  assert(MockWireLib->Called("write") == 3);
 
   // Check that we get a cached result
-  assert(cached.air_temp.has_error == false);
+  assert(cached.timestamp == 400);
+  assert(cached.air_temp.error == SENSOR_OK);
   assert(cached.air_temp.value < 20.5 && cached.air_temp.value > 19.5);
-  assert(cached.humidity.has_error == false);
-  assert(cached.humidity.value < 50.5 && cached.humidity.value > 49.5);
+  assert(cached.humidity.error == SENSOR_OK);
+  assert(cached.humidity.value < 92.5 && cached.humidity.value > 91.5);
+
+  // Keep using the cache while the sensor cools down
+  cached = testHarness.read_sensors(414);
+  assert(MockWireLib->Called("write") == 3);
+  assert(cached.timestamp == 414);
+
+  // Once it's cool, measure again
+  cmd = 0xFD;
+  MockWireLib->Expects("write.arg_1", 1, &cmd);
+  queue_sht40_response(MockWireLib, 0xC8, 0xB3, 0xF0);
+  testHarness.read_sensors(415);
+  assert(MockWireLib->Called("write") == 4);
+}
+
+void
+test_sht40_dry_no_heat()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = true,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+  };
+
+  // Get mock global Wire obj
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  testHarness.init(&config);
+  MockWireLib->Reset();
+
+  // Set up a dry sensor response
+  queue_sht40_response(MockWireLib, 0x72, 0xAF, 0xB1);
+  testHarness.read_sensors(20);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  SensorData results = testHarness.read_sensors(20);
+  assert(results.humidity.error == SENSOR_OK);
+  assert(results.humidity.value < 50.5 && results.humidity.value > 49.5);
+
+  // Well past the heat interval, the heater shouldn't be used
+  int cmd = 0xFD;
+  MockWireLib->Expects("write.arg_1", 1, &cmd);
+  queue_sht40_response(MockWireLib, 0x72, 0xAF, 0xB1);
+  testHarness.read_sensors(500);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(500);
+  assert(MockWireLib->Called("write") == 2);
+  assert(results.timestamp == 500);
+}
+
+void
+test_sensors_publish_one_snapshot()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = true,
+    .num_therm_sensors = 2,
+    .sample_interval = 1,
+    .async_temp_reads = true,
+    .temp_resolution = 12,
+  };
+
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+
+  int two = 2;
+  MockTherm->Returns("getDeviceCount", 1, &two);
+  testHarness.init(&config);
+  MockWireLib->Reset();
+
+  queue_sht40_response(MockWireLib, 0x72, 0xAF, 0xB1);
+  float t1 = 11.0, t2 = 14.0;
+  MockTherm->Returns("getTempC", 2, &t2, &t1);
+
+  // Both measurements are started by the same call
+  SensorData results = testHarness.read_sensors(20);
+  assert(MockWireLib->Called("write") == 1);
+  assert(MockTherm->Called("requestTemperatures") == 1);
+
+  // The SHT40 is collected first, but isn't published on its own
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(20);
+  assert(MockWireLib->Called("requestFrom") == 1);
+  assert(MockTherm->Called("getTempC") == 0);
+  assert(results.timestamp == 0);
+  assert(results.humidity.error != SENSOR_OK);
+
+  // Once the conversion is done, everything shows up together
+  AdvanceGlobalMillis(CONVERSION_TIME(12) - SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(21);
+  assert(MockTherm->Called("getTempC") == 2);
+  assert(MockWireLib->Called("write") == 1);
+  assert(results.timestamp == 21);
+  assert(results.humidity.error == SENSOR_OK);
+  assert(results.humidity.value < 50.5 && results.humidity.value > 49.5);
+  assert(results.high_temp.error == SENSOR_OK);
+  assert(results.high_temp.value < 14.5 && results.high_temp.value > 13.5);
+  assert(results.low_temp.error == SENSOR_OK);
+  assert(results.low_temp.value < 11.5 && results.low_temp.value > 10.5);
 }
 
 void
@@ -332,10 +1114,10 @@ test_no_sensors_available()
 
   // Check our results
   assert(results.timestamp == 0);
-  assert(results.high_temp.has_error == true);
-  assert(results.low_temp.has_error == true);
-  assert(results.air_temp.has_error == true);
-  assert(results.humidity.has_error == true);
+  assert(results.high_temp.error != SENSOR_OK);
+  assert(results.low_temp.error != SENSOR_OK);
+  assert(results.air_temp.error != SENSOR_OK);
+  assert(results.humidity.error != SENSOR_OK);
 }
 
 void
@@ -357,8 +1139,6 @@ test_sensors_respect_sample_interval()
   MockTherm->Returns("getDeviceCount", 1, &one);
   
   testHarness.init(&config);
-  bool boolt = true;
-  MockTherm->Returns("getAddress", 1, &boolt);
   float t = 20.0;
   MockTherm->Returns("getTempC", 1, &t);
 
@@ -367,9 +1147,9 @@ test_sensors_respect_sample_interval()
 
   // Check our results
   assert(results.timestamp == 20);
-  assert(results.high_temp.has_error == false);
+  assert(results.high_temp.error == SENSOR_OK);
   assert(results.high_temp.value < 20.5 && results.high_temp.value > 19.5);
-  assert(results.low_temp.has_error == false);
+  assert(results.low_temp.error == SENSOR_OK);
   assert(results.low_temp.value < 20.5 && results.low_temp.value > 19.5);
 
   // Call read_sensors again, make sure we don't hit hardware
@@ -379,6 +1159,66 @@ test_sensors_respect_sample_interval()
   assert(MockTherm->Called("getTempC") < 2);
 }
 
+void
+test_sensors_sample_on_own_schedule()
+{
+  Hardware testHarness = Hardware();
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = true,
+    .num_therm_sensors = 1,
+    .sample_interval = 5,
+    .sht_interval = 2,
+    .therm_interval = 60,
+  };
+
+  MockLib* MockWireLib = GetMock("Wire");
+  assert(MockWireLib != NULL);
+  MockLib* MockTherm = GetMock("DallasTemperature");
+  assert(MockTherm != NULL);
+  MockTherm->Reset();
+
+  int one = 1;
+  MockTherm->Returns("getDeviceCount", 1, &one);
+  testHarness.init(&config);
+  MockWireLib->Reset();
+
+  // Both sources are due on the first read
+  float t = 20.0;
+  MockTherm->Returns("getTempC", 1, &t);
+  queue_sht40_response(MockWireLib, 0x72, 0xAF, 0xB1);
+  testHarness.read_sensors(20);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  SensorData results = testHarness.read_sensors(20);
+  assert(results.timestamp == 20);
+  assert(MockWireLib->Called("write") == 1);
+  assert(MockTherm->Called("requestTemperatures") == 1);
+
+  // Nothing is due yet
+  results = testHarness.read_sensors(21);
+  assert(results.timestamp == 20);
+  assert(MockWireLib->Called("write") == 1);
+
+  // Only the SHT40 is due, the OneWire bus is left alone
+  queue_sht40_response(MockWireLib, 0x72, 0xAF, 0xB1);
+  testHarness.read_sensors(22);
+  AdvanceGlobalMillis(SHT40_READ_HIGH_DELAY);
+  results = testHarness.read_sensors(22);
+  assert(results.timestamp == 22);
+  assert(MockWireLib->Called("write") == 2);
+  assert(MockTherm->Called("requestTemperatures") == 1);
+  assert(MockTherm->Called("getTempC") == 1);
+  assert(results.high_temp.error == SENSOR_OK);
+  assert(results.high_temp.value < 20.5 && results.high_temp.value > 19.5);
+  assert(results.humidity.timestamp == 22);
+  assert(reading_age(results.high_temp, 22) == 2);
+
+  // The probes come due again after their own interval
+  MockTherm->Returns("getTempC", 1, &t);
+  queue_sht40_response(MockWireLib, 0x72, 0xAF, 0xB1);
+  testHarness.read_sensors(80);
+  assert(MockTherm->Called("requestTemperatures") == 2);
+}
+
 void
 test_wrong_number_of_sensors()
 {
@@ -395,29 +1235,59 @@ test_wrong_number_of_sensors()
 
   // Initialize the hardware, make sure thermometers are set up
   int two = 2;
+  bool boolt = true, boolf = false;
   MockTherm->Returns("getDeviceCount", 1, &two);
+  MockTherm->Returns("getAddress", 5, &boolf, &boolf, &boolf, &boolt, &boolt);
 
   testHarness.init(&config);
 
-  // Check that reading from sensors produces error
-  bool boolt = true, boolf = false;
-  MockTherm->Returns("getAddress", 2, &boolt, &boolf);
+  // Check that the missing sensors produce errors, without another search
+  float t1 = 11.0, t2 = 14.0;
+  MockTherm->Returns("getTempC", 2, &t2, &t1);
   SensorData reading = testHarness.read_sensors(21);
-  assert(reading.high_temp.has_error);
-  assert(reading.low_temp.has_error);
+  assert(MockTherm->Called("getAddress") == 5);
+  assert(reading.timestamp == 21);
+  assert(reading.num_probes == 5);
+  assert(reading.probes[0].error == SENSOR_OK);
+  assert(reading.probes[1].error == SENSOR_OK);
+  assert(reading.probes[2].error != SENSOR_OK);
+  assert(reading.probes[3].error != SENSOR_OK);
+  assert(reading.probes[4].error == SENSOR_MISSING);
+  assert(MockTherm->Called("getTempC") == 2);
+
+  // The sensors that are there still count
+  assert(reading.high_temp.error == SENSOR_OK);
+  assert(reading.high_temp.value < 14.5 && reading.high_temp.value > 13.5);
+  assert(reading.low_temp.error == SENSOR_OK);
+  assert(reading.low_temp.value < 11.5 && reading.low_temp.value > 10.5);
 }
 
 int
 main(void)
 {
   test_humidity_sensor_read();
+  test_humidity_sensor_precision();
   test_therm_sensors_read();
+  test_therm_sensors_async_read();
+  test_therm_resolution();
+  test_therm_sensors_multiple_buses();
+  test_therm_sensors_rescan();
+  test_therm_sensors_missing_not_retried();
   test_i2c_bus_error_handling();
+  test_i2c_bus_recovery_does_not_block();
+  test_sht40_error_while_bus_recovers();
+  test_i2c_clock_fallback();
   test_sht40_crc_fails();
   test_temp_sensor_bad_value();
+  test_temp_sensor_crc_error();
   test_sht40_does_heat();
+  test_sht40_dry_no_heat();
+  test_sensors_publish_one_snapshot();
   test_no_sensors_available();
   test_sensors_respect_sample_interval();
+  test_sensors_sample_on_own_schedule();
   test_wrong_number_of_sensors();
+  test_therm_sensors_hotplug();
+  test_therm_sensors_keep_channels();
   return 0;
 }
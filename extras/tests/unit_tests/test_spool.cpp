@@ -0,0 +1,135 @@
+#include <LittleFS.h>
+#include <MockLib.h>
+#include <Spool.h>
+#include <cassert>
+#include <cstring>
+
+/*
+ * Adds samples numbered by timestamp.
+ */
+void
+push_samples(Spool& spool, time_t from, int count)
+{
+  StatsEntry entry = {};
+  for (int i = 0; i < count; i++) {
+    entry.timestamp = from + i;
+    assert(spool.push(entry));
+  }
+}
+
+void
+test_spool_oldest_first()
+{
+  LittleFS.files.clear();
+  Spool spool;
+  assert(spool.size() == 0);
+
+  StatsEntry entries[4];
+  assert(spool.peek(entries, 4) == 0);
+
+  // Samples come back in the order they went in, and stay until popped
+  push_samples(spool, 100, 3);
+  assert(spool.size() == 3);
+  assert(spool.peek(entries, 2) == 2);
+  assert(entries[0].timestamp == 100);
+  assert(entries[1].timestamp == 101);
+  assert(spool.peek(entries, 4) == 3);
+  assert(entries[0].timestamp == 100);
+
+  spool.pop(2);
+  assert(spool.size() == 1);
+  assert(spool.peek(entries, 4) == 1);
+  assert(entries[0].timestamp == 102);
+
+  // Empty segments are removed
+  spool.pop(1);
+  assert(spool.size() == 0);
+  assert(!LittleFS.exists("/spool_0"));
+}
+
+void
+test_spool_is_bounded()
+{
+  LittleFS.files.clear();
+  Spool spool;
+
+  // Filling the last segment drops the oldest one
+  push_samples(spool, 0, SPOOL_SEGMENTS * SPOOL_SEGMENT_ENTRIES + 5);
+  assert(spool.size() == (SPOOL_SEGMENTS - 1) * SPOOL_SEGMENT_ENTRIES + 5);
+  assert(!LittleFS.exists("/spool_0"));
+  assert(LittleFS.files.size() == SPOOL_SEGMENTS + 1); // and the head
+
+  // Reads never cross into the next segment
+  StatsEntry entries[SPOOL_SEGMENT_ENTRIES + 1];
+  assert(spool.peek(entries, SPOOL_SEGMENT_ENTRIES + 1) ==
+         SPOOL_SEGMENT_ENTRIES);
+  assert(entries[0].timestamp == SPOOL_SEGMENT_ENTRIES);
+  spool.pop(SPOOL_SEGMENT_ENTRIES);
+  assert(spool.peek(entries, 1) == 1);
+  assert(entries[0].timestamp == 2 * SPOOL_SEGMENT_ENTRIES);
+}
+
+void
+test_spool_survives_restart()
+{
+  LittleFS.files.clear();
+  StatsEntry entries[4];
+  {
+    Spool spool;
+    push_samples(spool, 200, 4);
+    spool.pop(1);
+  }
+
+  Spool spool;
+  assert(spool.size() == 3);
+  assert(spool.peek(entries, 4) == 3);
+  assert(entries[0].timestamp == 201);
+
+  // A segment that can't be read is dropped
+  LittleFS.files["/spool_0"].resize(sizeof(StatsEntry));
+  assert(spool.peek(entries, 4) == 0);
+  assert(spool.size() == 0);
+}
+
+void
+test_spool_drops_other_layouts()
+{
+  LittleFS.files.clear();
+  StatsEntry entries[4];
+  {
+    Spool spool;
+    push_samples(spool, 300, 3);
+  }
+
+  // A spool of differently sized samples, from other firmware
+  SpoolHead head;
+  memcpy(&head, LittleFS.files["/spool_head"].data(), sizeof(head));
+  head.entry_size = sizeof(StatsEntry) - 4;
+  LittleFS.files["/spool_head"].assign((const char*)&head, sizeof(head));
+  {
+    Spool spool;
+    assert(spool.size() == 0);
+    assert(spool.peek(entries, 4) == 0);
+
+    // Its leftover segment is written over, not appended to
+    push_samples(spool, 400, 1);
+    assert(LittleFS.files["/spool_0"].size() == sizeof(StatsEntry));
+    assert(spool.peek(entries, 4) == 1);
+    assert(entries[0].timestamp == 400);
+  }
+
+  // Nor is a head from before the spool had a magic number read
+  LittleFS.files["/spool_head"].assign(3 * sizeof(unsigned long), '\0');
+  Spool spool;
+  assert(spool.size() == 0);
+}
+
+int
+main(void)
+{
+  test_spool_oldest_first();
+  test_spool_is_bounded();
+  test_spool_survives_restart();
+  test_spool_drops_other_layouts();
+  return 0;
+}
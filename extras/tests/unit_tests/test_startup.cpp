@@ -3,6 +3,7 @@
 #include <VivariumMonitor.h>
 #include <WiFiManager.h>
 #include <cassert>
+#include <cstring>
 
 void
 test_startup_first_boot()
@@ -91,15 +92,88 @@ test_startup_normal_boot()
   underTest.init(config);
 
   assert(MockFS->Called("begin") == 1);
-  assert(MockFS->Called("exists") == 1);
+  assert(MockFS->Called("exists") == 2);
   assert(MockFS->Called("end") == 1);
   assert(MockESP->Called("restart") == 0);
 }
 
+void
+test_startup_loads_probe_map()
+{
+  VivariumMonitor underTest;
+  VivariumMonitorConfig config = {
+    .has_sht_sensor = false,
+    .num_therm_sensors = 0,
+    .sample_interval = 1,
+  };
+
+  MockLib* MockWiFi = GetMock("WiFiManagerGlobal");
+  assert(MockWiFi != NULL);
+  MockWiFi->Reset();
+  MockLib* MockFS = GetMock("LittleFS");
+  assert(MockFS != NULL);
+  MockFS->Reset();
+
+  // Only the probe map is on the filesystem
+  ProbeChannel channels[MAX_THERM_SENSORS] = {};
+  channels[2] = { .addr = { 0x28, 1 }, .name = "basking" };
+  channels[5] = { .addr = { 0x28, 2 }, .name = "cool side" };
+  bool boolt = true, boolf = false;
+  size_t len = sizeof(channels);
+  File testFile;
+  testFile.Expects("readBytes.buffer", 1, channels);
+  testFile.Returns("readBytes", 1, &len);
+  MockFS->Returns("begin", 1, &boolt);
+  MockFS->Returns("exists", 2, &boolt, &boolf);
+  MockFS->Returns("open", 1, &testFile);
+
+  underTest.init(config);
+  assert(MockFS->Called("open") == 1);
+  assert(underTest.probeChannel("basking") == 2);
+  assert(underTest.probeChannel("cool side") == 5);
+  assert(underTest.probeChannel("hide") == -1);
+  assert(underTest.probeChannel("") == -1);
+
+  // Channels can be named from the sketch, and names stay unique
+  assert(underTest.nameProbeChannel(2, "warm side"));
+  assert(underTest.probeChannel("basking") == -1);
+  assert(underTest.probeChannel("warm side") == 2);
+  assert(underTest.nameProbeChannel(5, "warm side"));
+  assert(underTest.probeChannel("warm side") == 5);
+  assert(underTest.nameProbeChannel(0, "hide"));
+  assert(underTest.probeChannel("hide") == 0);
+  assert(!underTest.nameProbeChannel(MAX_THERM_SENSORS, "nowhere"));
+
+  // The new names are saved
+  LittleFS.files.clear();
+  underTest.handle_events();
+  ProbeChannel saved[MAX_THERM_SENSORS];
+  assert(LittleFS.files["/probe_map"].size() == sizeof(saved));
+  memcpy(saved, LittleFS.files["/probe_map"].data(), sizeof(saved));
+  assert(strcmp(saved[0].name, "hide") == 0);
+  assert(saved[2].name[0] == '\0');
+  assert(strcmp(saved[5].name, "warm side") == 0);
+  assert(saved[5].addr[1] == 2);
+
+  // If the filesystem can't be mounted, saving waits before trying again
+  LittleFS.files.clear();
+  assert(underTest.nameProbeChannel(2, "basking"));
+  MockFS->Reset();
+  MockFS->Returns("begin", 1, &boolf);
+  underTest.handle_events();
+  underTest.handle_events();
+  assert(MockFS->Called("begin") == 1);
+  AdvanceGlobalMillis(PROBE_MAP_RETRY);
+  underTest.handle_events();
+  assert(MockFS->Called("begin") == 2);
+  assert(LittleFS.files["/probe_map"].size() == sizeof(saved));
+}
+
 int
 main(void)
 {
   test_startup_first_boot();
   test_startup_normal_boot();
+  test_startup_loads_probe_map();
   return 0;
 }
@@ -1,6 +1,7 @@
 #include <ESP8266WiFi.h>
 #include <MockLib.h>
 #include <Network.h>
+#include <StreamUtils.h>
 #include <cassert>
 #include <string>
 #include <vector>
@@ -20,6 +21,9 @@ test_serves_correct_update_path()
     .port = 80,
     .set = true,
   };
+  BusHealth health = {};
+  health.i2c.transactions = 7;
+  health.onewire.failures[0] = 2;
 
   // Get mock web server
   MockLib* MockWebServer = GetMock("WiFiServer");
@@ -27,7 +31,7 @@ test_serves_correct_update_path()
   MockWebServer->Reset();
 
   // Init the library
-  testHarness.init(&config, update_url);
+  testHarness.init(&config, update_url, &health);
   assert(MockWebServer->Called("begin") == 1);
 
   // get mock ESP library
@@ -43,6 +47,10 @@ test_serves_correct_update_path()
   testHarness.serve_web_interface();
   assert(netOut.empty());
 
+  // Fail an update check
+  SetGlobalInputStream("");
+  testHarness.update_firmware(FIRMWARE_CHECK_SECONDS);
+
   // Now add some data
   bool boolt = true;
   int one = 1;
@@ -56,6 +64,13 @@ test_serves_correct_update_path()
   testHarness.serve_web_interface();
   assert(LogHasText("HTTP/1.0 200 OK\r\n", &netOut));
   assert(LogHasText("<b>Update URL:</b> http://example.org:80/test", &netOut));
+  assert(LogHasText("<b>Update breaker:</b> closed, 1 failures, next try "
+                    "<span class=\"time\">",
+                    &netOut));
+  assert(!LogHasText("<b>Report breaker:</b>", &netOut));
+  assert(LogHasText("<b>I2C bus:</b> 7 transactions, 0 failed", &netOut));
+  assert(LogHasText("<b>OneWire bus:</b> 0 transactions, 2 failed", &netOut));
+  assert(!LogHasText("<b>Outputs acknowledged:</b>", &netOut));
 
   // Check that we did NOT reset the device
   assert(MockESP->Called("eraseConfig") == 0);
@@ -0,0 +1,30 @@
+/*
+ * CRC.h
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+#include "types.h"
+#include <stddef.h>
+
+/*
+ * CRC-8 used by the SHT40 and output controller frames: polynomial 0x31,
+ * starting from 0xFF.
+ */
+#define CRC8_INIT 0xFF
+
+/*
+ * Computes the CRC-8 of a buffer, a byte at a time from a lookup table.
+ * Pass the result of a previous call as crc to continue it.
+ */
+byte crc8(const byte* data, size_t len, byte crc = CRC8_INIT);
+
+/*
+ * Computes the CRC-8 of a 16 bit word, sent most significant byte first.
+ */
+byte crc8_word(unsigned int value);
+
+#endif
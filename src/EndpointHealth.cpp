@@ -0,0 +1,72 @@
+/*
+ * EndpointHealth.cpp
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#include "EndpointHealth.h"
+#include "debug.h"
+
+#include <Arduino.h>
+
+/*
+ * Sets how long to wait after the first failure, and how long the breaker
+ * stays open.
+ */
+void
+EndpointHealth::init(unsigned long backoff_seconds,
+                     unsigned long cooldown_seconds)
+{
+  backoff = backoff_seconds;
+  cooldown = cooldown_seconds;
+  success();
+}
+
+/*
+ * Whether a request can go out now. Once an open breaker's cool-down is
+ * over, lets exactly one through as a probe.
+ */
+bool
+EndpointHealth::ready(time_t now)
+{
+  if (breaker == BREAKER_HALF_OPEN || now < retry_at) {
+    return false;
+  }
+  if (breaker == BREAKER_OPEN) {
+    DEBUG_MSG("Cool-down over, probing endpoint.\n");
+    breaker = BREAKER_HALF_OPEN;
+  }
+  return true;
+}
+
+/*
+ * Records that the endpoint answered.
+ */
+void
+EndpointHealth::success()
+{
+  breaker = BREAKER_CLOSED;
+  failed = 0;
+  retry_at = 0;
+}
+
+/*
+ * Records that the endpoint didn't answer, and works out when to try next.
+ */
+void
+EndpointHealth::failure(time_t now)
+{
+  failed++;
+  if (breaker == BREAKER_HALF_OPEN || failed >= BREAKER_FAILURES) {
+    DEBUG_MSG("Endpoint failed %d times, opening breaker.\n", failed);
+    breaker = BREAKER_OPEN;
+    retry_at = now + cooldown;
+    return;
+  }
+  // Doubles with each failure, until the breaker opens
+  unsigned long wait = backoff << (failed - 1);
+  // Wait between half and all of it
+  wait = wait / 2 + ESP.random() % (wait / 2 + 1);
+  DEBUG_MSG("Endpoint failed %d times, retrying in %lus.\n", failed, wait);
+  retry_at = now + wait;
+}
@@ -0,0 +1,51 @@
+/*
+ * EndpointHealth.h
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#ifndef ENDPOINT_HEALTH_H
+#define ENDPOINT_HEALTH_H
+
+#include "types.h"
+#include <time.h>
+
+/*
+ * Failures in a row that open the breaker
+ */
+#define BREAKER_FAILURES 5
+
+/*
+ * Breaker states
+ */
+#define BREAKER_CLOSED 0    // Requests go out, backing off after failures
+#define BREAKER_OPEN 1      // No requests until the cool-down ends
+#define BREAKER_HALF_OPEN 2 // One probe request is out
+
+/*
+ * Tracks whether an endpoint is answering, and when it's next worth trying.
+ * The wait after a failure doubles with each one in a row, with jitter so
+ * devices that lost the server together don't all come back at once. After
+ * BREAKER_FAILURES in a row the breaker opens, and only a single probe goes
+ * out once the cool-down is over.
+ */
+class EndpointHealth
+{
+public:
+  void init(unsigned long backoff_seconds, unsigned long cooldown_seconds);
+  bool ready(time_t now);
+  void success();
+  void failure(time_t now);
+  byte state() const { return breaker; }
+  unsigned int failures() const { return failed; }
+  time_t retryAt() const { return retry_at; }
+
+private:
+  unsigned long backoff = 0; // Wait after the first failure
+  unsigned long cooldown = 0;
+  byte breaker = BREAKER_CLOSED;
+  unsigned int failed = 0; // Failures in a row
+  time_t retry_at = 0;
+};
+
+#endif
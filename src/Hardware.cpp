@@ -5,12 +5,13 @@
  */
 
 #include "Hardware.h"
+#include "CRC.h"
+#include "I2CBus.h"
 #include "debug.h"
 
 #include <Arduino.h>
 #include <DallasTemperature.h>
 #include <OneWire.h>
-#include <Wire.h>
 
 /**********************************************************
    Global vars
@@ -23,40 +24,76 @@ struct
   int attempts;
 } Outputs;
 
-OneWire oneWire(ONE_WIRE_BUS);
-DallasTemperature thermometers(&oneWire);
+BusHealth Health;
+
+I2CBus i2c;
+OneWire oneWire[MAX_ONE_WIRE_BUSES];
+DallasTemperature thermometers[MAX_ONE_WIRE_BUSES];
 
 void
 Hardware::init(VivariumMonitorConfig* config)
 {
   monitor_config = config;
 
+  // Sources without their own schedule follow sample_interval
+  sht_interval = config->sht_interval ? config->sht_interval
+                                      : config->sample_interval;
+  therm_interval = config->therm_interval ? config->therm_interval
+                                          : config->sample_interval;
+
   // start i2c interface
-  Wire.begin();
+  memset(&Health, 0, sizeof(Health));
+  i2c.begin(config->i2c_clock ? config->i2c_clock : I2C_STANDARD_CLOCK,
+            &Health.i2c);
+
+  // Match the SHT40 command to the wait for its result
+  switch (config->sht_precision) {
+    case SHT_PRECISION_MEDIUM:
+      sht_read_cmd = SHT40_READ_MEDIUM_CMD;
+      sht_read_delay = SHT40_READ_MEDIUM_DELAY;
+      break;
+    case SHT_PRECISION_LOW:
+      sht_read_cmd = SHT40_READ_LOW_CMD;
+      sht_read_delay = SHT40_READ_LOW_DELAY;
+      break;
+    default:
+      sht_read_cmd = SHT40_READ_HIGH_CMD;
+      sht_read_delay = SHT40_READ_HIGH_DELAY;
+  }
 
   // set up OneWire interface
-  thermometers.begin();
-  thermometers.setResolution(RESOLUTION);
-  int numTherms = thermometers.getDeviceCount();
-  if (numTherms != config->num_therm_sensors) {
-    DEBUG_MSG(
-      "!!! Expected %d temp sensors, only found %d. Continuing without them\n",
-      config->num_therm_sensors,
-      numTherms);
+  therm_resolution = pickTempResolution();
+  DEBUG_MSG("Using %d bit temp sensor resolution\n", therm_resolution);
+  if (config->num_therm_sensors > MAX_THERM_SENSORS) {
+    DEBUG_MSG("!!! Only %d temp sensors are supported.\n", MAX_THERM_SENSORS);
+    config->num_therm_sensors = MAX_THERM_SENSORS;
   }
+  setupTempBuses();
+  scanTempSensors();
 
   // Set reading to initial value
   reading.timestamp = 0;
-  reading.humidity.has_error = true;
-  reading.air_temp.has_error = true;
-  reading.high_temp.has_error = true;
-  reading.low_temp.has_error = true;
+  reading.humidity = { .error = SENSOR_NOT_READ, .timestamp = 0 };
+  reading.air_temp = { .error = SENSOR_NOT_READ, .timestamp = 0 };
+  reading.high_temp = { .error = SENSOR_NOT_READ, .timestamp = 0 };
+  reading.low_temp = { .error = SENSOR_NOT_READ, .timestamp = 0 };
+  reading.num_probes = config->num_therm_sensors;
+  for (int i = 0; i < MAX_THERM_SENSORS; i++) {
+    reading.probes[i] = { .error = SENSOR_NOT_READ, .timestamp = 0 };
+  }
+  pending = reading;
+  sht_sampled = 0;
+  therm_sampled = 0;
+  last_hotplug_check = 0;
+  sht_retry = {};
+  therm_retry = {};
 
   // set up initial outputs
   Outputs.digital_1 = 0;
   Outputs.digital_2 = 0;
   Outputs.analog = 0;
   Outputs.attempts = 0;
+  Health.outputs_acknowledged = false;
   write_outputs();
 }
 
@@ -67,164 +104,196 @@ Hardware::init(VivariumMonitorConfig* config)
 bool
 crc8_check(int value, byte check)
 {
-  byte crc = 0xFF;
-  for (byte bit = 16; bit > 0; bit--) {
-    if (((value & 0x8000) >> 8) == (crc & 0x80))
-      crc = (crc << 1);
-    else
-      crc = (crc << 1) ^ 0x31;
-    value = (value << 1) & 0xFFFF;
-  }
-  return crc == check;
+  return crc8_word(value) == check;
 }
 
+/*
+ * Decides whether a failed read gets another try within the same sample, and
+ * how long to wait first. Corrupt data is retried right away, bus errors back
+ * off while the bus recovers, and a missing device gets one try after a
+ * rescan.
+ */
 void
-reset_i2c_bus()
+schedule_retry(RetryState& retry, byte error)
 {
-  /*
-   * Code in this function adapted from:
-   *   https://www.forward.com.au/pfod/ArduinoProgramming/I2C_ClearBus/index.html
-   *   Written by Matthew Ford, released into open domain.
-   */
-  int counter, clockCount = 20;
-
-  DEBUG_MSG("Resetting i2c bus...\n");
-  // Manually control I2C pins
-  pinMode(SDA, INPUT_PULLUP);
-  pinMode(SCL, INPUT_PULLUP);
-
-  // Check SCL is not held low
-  if (digitalRead(SCL) == LOW) {
-    DEBUG_MSG("I2C bus error. Could not clear sclPin clock line held low\n");
-    return;
-  }
-
-  // Reset the bus
-  while (digitalRead(SDA) == LOW && clockCount > 0) {
-    clockCount--;
-    // Note: I2C bus is open collector so do NOT drive sclPin or sdaPin high.
-    pinMode(
-      SCL,
-      INPUT); // release sclPin pullup so that when made output it will be LOW
-    pinMode(SCL, OUTPUT);       // then clock sclPin Low
-    delayMicroseconds(10);      //  for >5us
-    pinMode(SCL, INPUT);        // release sclPin LOW
-    pinMode(SCL, INPUT_PULLUP); // turn on pullup resistors again
-    // do not force high as slave may be holding it low for clock stretching.
-    delayMicroseconds(
-      10); //  for >5u so that even the slowest I2C devices are handled.
-    //  loop waiting for sclPin to become High only wait 2sec.
-    counter = 20;
-    while (digitalRead(SCL) == LOW && counter > 0) {
-      counter--;
-      delay(100);
-    }
-    if (digitalRead(SCL) == LOW) { // still low after 2 sec error
-      DEBUG_MSG("I2C bus error. Could not clear. sclPin clock line held low by "
-                "slave clock stretch for >2sec\n");
+  byte limit;
+  unsigned long wait = 0;
+  switch (error) {
+    case SENSOR_CRC_ERROR:
+    case SENSOR_SHORT_READ:
+      limit = CRC_ERROR_RETRIES;
+      break;
+    case SENSOR_BUS_ERROR:
+      limit = BUS_ERROR_RETRIES;
+      wait = (unsigned long)BUS_ERROR_BACKOFF << retry.attempts;
+      break;
+    case SENSOR_MISSING:
+      limit = MISSING_RETRIES;
+      break;
+    default:
       return;
-    }
   }
-  if (digitalRead(SDA) == LOW) {
-    DEBUG_MSG("I2C bus error. Could not clear. sdaPin data line held low\n");
+  if (retry.attempts >= limit) {
+    DEBUG_MSG("Giving up on read after %d retries.\n", retry.attempts);
     return;
   }
-  // else pull sdaPin line low for Start or Repeated Start
-  pinMode(SDA, INPUT);  // remove pullup.
-  pinMode(SDA, OUTPUT); // and then make it LOW i.e. send an I2C Start or
-                        // Repeated start control.
-  // When there is only one I2C master a Start or Repeat Start has the same
-  // function as a Stop and clears the bus. A Repeat Start is a Start occurring
-  // after a Start with no intervening Stop.
-  delayMicroseconds(10); // wait >5us
-  pinMode(SDA, INPUT);   // remove output low
-  pinMode(SDA,
-          INPUT_PULLUP); // and make sdaPin high i.e. send I2C STOP control.
-  delayMicroseconds(10); // x. wait >5us
-  pinMode(SDA, INPUT_PULLUP); // Make sdaPin (data) and sclPin (clock) pins
-                              // Inputs with pullup.
-  pinMode(SCL, INPUT_PULLUP);
-
-  // Start Wire interface
-  Wire.begin();
+  retry.attempts++;
+  retry.pending = true;
+  retry.started = millis();
+  retry.wait = wait;
+}
+
+/*
+ * Checks if a scheduled retry should run now.
+ */
+bool
+retry_due(RetryState& retry)
+{
+  if (!retry.pending || millis() - retry.started < retry.wait) {
+    return false;
+  }
+  retry.pending = false;
+  return true;
 }
 
 /**********************************************************
    Private functions
  **********************************************************/
+
+/*
+ * Decides if the SHT40 heater should run, returning the heater command to
+ * use or 0. The heater only runs once humidity has stayed above the
+ * threshold for HEAT_INTERVAL, and the pulse gets stronger the closer the
+ * air is to saturation. The cool down period is matched to the pulse.
+ */
+byte
+Hardware::pickHeaterCmd(SensorReading& humidity, time_t now)
+{
+  byte threshold = monitor_config->sht_heater_rh ? monitor_config->sht_heater_rh
+                                                 : SHT40_HEATER_RH;
+  if (humidity.error || humidity.value <= threshold) {
+    rh_high_since = 0;
+    return 0;
+  }
+  if (!rh_high_since) {
+    rh_high_since = now;
+  }
+  if (now - rh_high_since < HEAT_INTERVAL ||
+      now - last_heated < HEAT_INTERVAL) {
+    return 0;
+  }
+
+  if (humidity.value >= SHT40_SATURATED_RH) {
+    sht_cooldown = SHT40_HEATER_HIGH_COOLDOWN;
+    return SHT40_HEATER_HIGH_CMD;
+  }
+  if (humidity.value >= threshold + SHT40_HEATER_RH_STEP) {
+    sht_cooldown = SHT40_HEATER_MEDIUM_COOLDOWN;
+    return SHT40_HEATER_MEDIUM_CMD;
+  }
+  sht_cooldown = SHT40_HEATER_LOW_COOLDOWN;
+  return SHT40_HEATER_LOW_CMD;
+}
+
+/*
+ * Sends a measurement (or heater) command to the SHT40 sensor.
+ */
 bool
 Hardware::readSHTsensor(SensorData& output, time_t now)
 {
   int bus_status;
   bool use_cache;
-  byte cmd = SHT40_READ_CMD;
+  byte cmd = sht_read_cmd;
 
   if (!monitor_config->has_sht_sensor) {
-    output.air_temp.has_error = true;
-    output.humidity.has_error = true;
+    output.air_temp.error = SENSOR_NOT_READ;
+    output.humidity.error = SENSOR_NOT_READ;
     return false;
   }
 
   DEBUG_MSG("Reading SHT40 sensor...\n");
-  if (now - last_heated >= HEAT_INTERVAL) {
+  if (!i2c.ready()) {
+    DEBUG_MSG("Waiting on i2c bus to be cleared.\n");
+    output.air_temp.error = SENSOR_BUS_ERROR;
+    output.humidity.error = SENSOR_BUS_ERROR;
+    schedule_retry(sht_retry, SENSOR_BUS_ERROR);
+    return false;
+  }
+  byte heater_cmd = pickHeaterCmd(output.humidity, now);
+  if (heater_cmd) {
     // send heater command
     last_heated = now;
-    cmd = SHT40_HEATER_CMD;
+    cmd = heater_cmd;
     DEBUG_MSG("Activating heater\n");
   }
 
-  // Give the device 15 sec to cool down after turning on heater
-  use_cache = !(cmd == SHT40_HEATER_CMD) && now - last_heated < 15;
+  // Give the device time to cool down after turning on heater
+  use_cache = !heater_cmd && now - last_heated < sht_cooldown;
 
   if (!use_cache) {
     // send command
-    Wire.beginTransmission(SHT40_ADDRESS);
-    Wire.write(cmd);
-    bus_status = Wire.endTransmission();
+    bus_status = i2c.write(SHT40_ADDRESS, &cmd, 1);
     if (bus_status > 0) {
       DEBUG_MSG("Error requesting data from SHT40! I2c bus error %d.\n",
                 bus_status);
-      if (bus_status == 4) {
-        // status 4 indicates error with bus
-        reset_i2c_bus();
-      }
-      output.air_temp.has_error = true;
-      output.humidity.has_error = true;
+      // status 2 is a NACK on the address
+      byte error = bus_status == 2 ? SENSOR_MISSING : SENSOR_BUS_ERROR;
+      output.air_temp.error = error;
+      output.humidity.error = error;
+      schedule_retry(sht_retry, error);
       return false;
     }
   }
 
-  if (cmd == SHT40_HEATER_CMD || use_cache) {
+  if (heater_cmd || use_cache) {
     DEBUG_MSG("Using cached temp/humidity value.\n");
     return true;
   }
 
-  // attempt to read from sensor
-  delay(300);
-  byte len = Wire.requestFrom(SHT40_ADDRESS, 6);
+  // The measurement is collected on a later call, once it's had time to
+  // complete.
+  sht_measuring = true;
+  sht_cmd_sent = millis();
+  return false;
+}
+
+/*
+ * Collects the result of a measurement started by readSHTsensor.
+ */
+bool
+Hardware::collectSHTsensor(SensorData& output, time_t now)
+{
+  sht_measuring = false;
+  if (!i2c.ready()) {
+    DEBUG_MSG("Waiting on i2c bus to be cleared.\n");
+    output.air_temp.error = SENSOR_BUS_ERROR;
+    output.humidity.error = SENSOR_BUS_ERROR;
+    schedule_retry(sht_retry, SENSOR_BUS_ERROR);
+    return false;
+  }
+  byte buff[6];
+  byte len = i2c.read(SHT40_ADDRESS, buff, 6);
   if (len != 6) {
     DEBUG_MSG("Error: SHT40 returned %d bytes, not 6.\n", len);
-    output.air_temp.has_error = true;
-    output.humidity.has_error = true;
+    output.air_temp.error = SENSOR_SHORT_READ;
+    output.humidity.error = SENSOR_SHORT_READ;
+    schedule_retry(sht_retry, SENSOR_SHORT_READ);
     return false;
   }
 
   bool hasGoodValue = false;
-  // read response into a buffer
-  int buff[6];
-  for (byte i = 0; i < 6; i++) {
-    buff[i] = Wire.read();
-  }
 
   // check tempurature crc
   int t_ticks = (buff[0] << 8) + buff[1];
   byte checksum_t = buff[2];
   if (!crc8_check(t_ticks, checksum_t)) {
-    output.air_temp.has_error = true;
+    i2c.corrupted();
+    output.air_temp.error = SENSOR_CRC_ERROR;
     DEBUG_MSG("SHT40 tempurature checksum verification failed!\n");
   } else {
-    output.air_temp.has_error = false;
+    output.air_temp.error = SENSOR_OK;
     output.air_temp.value = -45.0 + 175.0 * (float)t_ticks / 65535.0;
+    output.air_temp.timestamp = now;
     hasGoodValue = true;
   }
 
@@ -232,67 +301,338 @@ Hardware::readSHTsensor(SensorData& output, time_t now)
   int rh_ticks = (buff[3] << 8) + buff[4];
   byte checksum_rh = buff[5];
   if (!crc8_check(rh_ticks, checksum_rh)) {
-    output.humidity.has_error = true;
+    i2c.corrupted();
+    output.humidity.error = SENSOR_CRC_ERROR;
     DEBUG_MSG("SHT40 humidity checksum verification failed!\n");
   } else {
-    output.humidity.has_error = false;
+    output.humidity.error = SENSOR_OK;
     output.humidity.value = -6.0 + 125.0 * (float)rh_ticks / 65535.0;
     if (output.humidity.value > 100)
       output.humidity.value = 100;
     else if (output.humidity.value < 0)
       output.humidity.value = 0;
+    output.humidity.timestamp = now;
     hasGoodValue = true;
   }
 
+  if (output.air_temp.error || output.humidity.error) {
+    schedule_retry(sht_retry, SENSOR_CRC_ERROR);
+  }
   return hasGoodValue;
 }
 
 /*
- * Read low and high temps from DS18B20 sensors.
+ * Picks the DS18B20 resolution, either from the config or as the finest one
+ * whose conversion fits in its share of the sample interval. Blocking
+ * conversions stall the whole loop, so they get a smaller share.
+ */
+byte
+Hardware::pickTempResolution()
+{
+  if (monitor_config->temp_resolution >= MIN_RESOLUTION &&
+      monitor_config->temp_resolution <= MAX_RESOLUTION) {
+    return monitor_config->temp_resolution;
+  }
+  if (monitor_config->temp_resolution != 0) {
+    DEBUG_MSG("!!! Invalid temp sensor resolution %d, picking one instead.\n",
+              monitor_config->temp_resolution);
+  }
+
+  unsigned long budget = therm_interval * 1000UL;
+  budget /= monitor_config->async_temp_reads ? ASYNC_CONVERSION_SHARE
+                                             : BLOCKING_CONVERSION_SHARE;
+  byte res = MAX_RESOLUTION;
+  while (res > MIN_RESOLUTION && CONVERSION_TIME(res) > budget) {
+    res--;
+  }
+  return res;
+}
+
+/*
+ * Starts each OneWire bus, and works out which bus each DS18B20 is on.
+ */
+void
+Hardware::setupTempBuses()
+{
+  num_buses = monitor_config->num_one_wire_buses;
+  if (num_buses > MAX_ONE_WIRE_BUSES) {
+    DEBUG_MSG("!!! Only %d OneWire buses are supported.\n",
+              MAX_ONE_WIRE_BUSES);
+    num_buses = MAX_ONE_WIRE_BUSES;
+  }
+  if (num_buses == 0) {
+    // Everything is on the default bus
+    num_buses = 1;
+    oneWire[0].begin(ONE_WIRE_BUS);
+    bus_probes[0] = monitor_config->num_therm_sensors;
+  } else {
+    for (byte bus = 0; bus < num_buses; bus++) {
+      oneWire[bus].begin(monitor_config->one_wire_pins[bus]);
+      bus_probes[bus] = monitor_config->one_wire_probes[bus];
+    }
+  }
+
+  for (byte bus = 0; bus < num_buses; bus++) {
+    DallasTemperature& therms = thermometers[bus];
+    therms.setOneWire(&oneWire[bus]);
+    therms.begin();
+    therms.setResolution(therm_resolution);
+    // Blocking reads wait in startTempConversion, so the buses convert at
+    // the same time
+    therms.setWaitForConversion(false);
+    int found = therms.getDeviceCount();
+    if (found != bus_probes[bus]) {
+      DEBUG_MSG("!!! Expected %d temp sensors on bus %d, only found %d. "
+                "Continuing without them\n",
+                bus_probes[bus],
+                bus,
+                found);
+    }
+  }
+  mapTempSensors();
+}
+
+/*
+ * Lists where each DS18B20 sensor is, in bus order, from the count on each
+ * bus.
+ */
+void
+Hardware::mapTempSensors()
+{
+  unsigned int total = 0;
+  for (byte bus = 0; bus < num_buses; bus++) {
+    for (byte i = 0; i < bus_probes[bus] && total < MAX_THERM_SENSORS;
+         i++, total++) {
+      scan_bus[total] = bus;
+      scan_index[total] = i;
+    }
+  }
+  if (total != monitor_config->num_therm_sensors) {
+    DEBUG_MSG("Using %d temp sensors, not %d.\n",
+              total,
+              monitor_config->num_therm_sensors);
+    monitor_config->num_therm_sensors = total;
+  }
+}
+
+/*
+ * Looks for probes that were plugged in, unplugged or swapped since the last
+ * scan. Newly found probes get their own channels. Returns true if anything
+ * changed.
+ */
+bool
+Hardware::checkTempSensors()
+{
+  bool changed = false;
+  int old_count = monitor_config->num_therm_sensors;
+  DEBUG_MSG("Checking for added or removed temp sensors...\n");
+  for (byte bus = 0; bus < num_buses; bus++) {
+    DallasTemperature& therms = thermometers[bus];
+    // Searches the bus again, new probes start out at the default resolution
+    therms.begin();
+    therms.setResolution(therm_resolution);
+    int found = therms.getDeviceCount();
+    if (found > bus_probes[bus]) {
+      DEBUG_MSG("%d temp sensors added on bus %d.\n",
+                found - bus_probes[bus],
+                bus);
+      bus_probes[bus] = found;
+      changed = true;
+    }
+  }
+  if (changed) {
+    mapTempSensors();
+  }
+
+  // Compare the ROM table before and after looking the sensors up again
+  byte old_addrs[MAX_THERM_SENSORS][8];
+  bool old_found[MAX_THERM_SENSORS];
+  memcpy(old_addrs, therm_addrs, sizeof(old_addrs));
+  memcpy(old_found, therm_found, sizeof(old_found));
+  scanTempSensors();
+  for (int i = 0; i < monitor_config->num_therm_sensors; i++) {
+    bool was_found = i < old_count && old_found[i];
+    if (therm_found[i] != was_found ||
+        (therm_found[i] && memcmp(therm_addrs[i], old_addrs[i], 8) != 0)) {
+      DEBUG_MSG("Temp sensor %d was %s.\n",
+                i,
+                !therm_found[i] ? "removed"
+                : was_found     ? "replaced"
+                                : "added");
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    Health.probe_changes++;
+    reading.num_probes = monitor_config->num_therm_sensors;
+  }
+  return changed;
+}
+
+/*
+ * Looks up the addresses of the DS18B20 sensors on the buses, so that reads
+ * don't have to search for them, and puts each on its pinned channel.
+ */
+void
+Hardware::scanTempSensors()
+{
+  int num_sensors = monitor_config->num_therm_sensors;
+  byte addrs[MAX_THERM_SENSORS][8];
+  bool found[MAX_THERM_SENSORS];
+  bool placed[MAX_THERM_SENSORS] = {};
+
+  DEBUG_MSG("Scanning for temp sensors...\n");
+  Health.onewire.resets++;
+  for (int i = 0; i < num_sensors; i++) {
+    found[i] = thermometers[scan_bus[i]].getAddress(addrs[i], scan_index[i]);
+    therm_found[i] = false;
+  }
+
+  // Pinned sensors go back on their own channels, wherever they are now
+  for (int i = 0; i < num_sensors; i++) {
+    int slot = found[i] ? channels.slot(addrs[i]) : -1;
+    if (slot >= 0 && slot < num_sensors) {
+      placeTempSensor(slot, scan_bus[i], addrs[i]);
+      placed[i] = true;
+    }
+  }
+
+  // New sensors get the first free channel, then the channel of a pinned
+  // sensor that has gone missing
+  for (int i = 0; i < num_sensors; i++) {
+    if (!found[i] || placed[i]) {
+      continue;
+    }
+    int slot = 0;
+    while (slot < num_sensors &&
+           (therm_found[slot] || channels.address(slot))) {
+      slot++;
+    }
+    if (slot == num_sensors) {
+      for (slot = 0; slot < num_sensors && therm_found[slot]; slot++) {
+      }
+    }
+    DEBUG_MSG("Pinning new temp sensor to channel %d.\n", slot);
+    channels.assign(slot, addrs[i]);
+    placeTempSensor(slot, scan_bus[i], addrs[i]);
+  }
+  therm_rescan = false;
+}
+
+void
+Hardware::placeTempSensor(byte slot, byte bus, const byte* addr)
+{
+  memcpy(therm_addrs[slot], addr, sizeof(therm_addrs[slot]));
+  therm_bus[slot] = bus;
+  therm_found[slot] = true;
+}
+
+/*
+ * Starts a temperature conversion on every OneWire bus. Unless async reads
+ * are enabled, this blocks until the conversions are done. The full
+ * conversion time is waited out, since a bus with no probes answering looks
+ * finished right away.
+ */
+void
+Hardware::startTempConversion()
+{
+  DEBUG_MSG("Requesting temps...\n");
+  for (byte bus = 0; bus < num_buses; bus++) {
+    thermometers[bus].requestTemperatures();
+  }
+  if (!monitor_config->async_temp_reads) {
+    delay(CONVERSION_TIME(therm_resolution));
+  }
+  therm_converting = true;
+  therm_conv_started = millis();
+}
+
+/*
+ * Read each DS18B20 sensor, along with the low and high temps among them.
+ * Sensors with errors are left out of the low and high temps. A reread only
+ * reads the sensors whose data was corrupted.
  */
 bool
-Hardware::readTempSensors(SensorData& output)
+Hardware::readTempSensors(SensorData& output, time_t now, bool reread)
 {
+  bool hasGoodValue = false;
+  bool corrupted = false;
   DEBUG_MSG("Reading temp sensors...\n");
+  therm_converting = false;
 
-  // request temps
-  thermometers.requestTemperatures();
+  // loop through the known devices on the bus
+  for (int i = 0; i < monitor_config->num_therm_sensors; i++) {
+    SensorReading& probe = output.probes[i];
+    if (reread && probe.error != SENSOR_CRC_ERROR) {
+      continue;
+    }
+    probe.error = SENSOR_MISSING;
+    if (!therm_found[i]) {
+      // Already missing when the sample started, so another scan won't find
+      // it either. The hot-plug check looks for it again.
+      DEBUG_MSG("Error: Temp sensor %d cannot be found\n", i);
+      Health.onewire.failures[0]++;
+      continue;
+    }
+
+    DallasTemperature& therms = thermometers[therm_bus[i]];
+    unsigned long started = micros();
+    float t = therms.getTempC(therm_addrs[i]);
+    record_transaction(Health.onewire, started);
+    if (t < -55) {
+      // Large negative values indicate error conditions. A sensor that still
+      // answers sent back corrupted data, so its scratchpad is read again.
+      byte scratch_pad[9];
+      if (therms.readScratchPad(therm_addrs[i], scratch_pad)) {
+        DEBUG_MSG("Error: Temp sensor %d failed its CRC check\n", i);
+        Health.onewire.crc_failures++;
+        probe.error = SENSOR_CRC_ERROR;
+        corrupted = true;
+        continue;
+      }
+      // One that doesn't may have moved, see if it's still on the bus
+      DEBUG_MSG("Error: Temp sensor %d returned error: %0.f\n", i, t);
+      Health.onewire.failures[0]++;
+      therm_rescan = true;
+      continue;
+    }
+    probe.error = SENSOR_OK;
+    probe.value = t;
+    probe.timestamp = now;
+  }
 
   output.high_temp.value = -55;
   output.low_temp.value = 125;
-  output.low_temp.has_error = true;
-  output.high_temp.has_error = true;
-
-  // loop through the devices on the bus
-  for (int i = 0; i < monitor_config->num_therm_sensors; i++)
-  {
-    uint8_t addr;
-    if (thermometers.getAddress(&addr, i)) {
-      float t = thermometers.getTempC(&addr);
-      if (t < -55) {
-        // Large negative values indicate error conditions
-        DEBUG_MSG("Error: Temp sensor %d returned error: %0.f\n", i, t);
-        return false;
-      }
-      if (t > output.high_temp.value) {
-        output.high_temp.value = t;
-      }
-      if (t < output.low_temp.value) {
-        output.low_temp.value = t;
-      }
+  output.low_temp.error = SENSOR_MISSING;
+  output.high_temp.error = SENSOR_MISSING;
+  for (int i = 0; i < monitor_config->num_therm_sensors; i++) {
+    SensorReading& probe = output.probes[i];
+    if (probe.error) {
+      continue;
+    }
+    hasGoodValue = true;
+    if (probe.value > output.high_temp.value) {
+      output.high_temp.value = probe.value;
     }
-    else {
-       DEBUG_MSG("Error: Temp sensor %d cannot be found\n", i);
-       return false;
+    if (probe.value < output.low_temp.value) {
+      output.low_temp.value = probe.value;
     }
   }
 
-  if (monitor_config->num_therm_sensors > 0) {
-    output.low_temp.has_error = false;
-    output.high_temp.has_error = false;
-    return true;
+  if (hasGoodValue) {
+    output.low_temp.error = SENSOR_OK;
+    output.high_temp.error = SENSOR_OK;
+    output.low_temp.timestamp = now;
+    output.high_temp.timestamp = now;
   }
-  return false;
+  if (therm_rescan) {
+    // The rescan converts again, which covers corrupted reads too
+    schedule_retry(therm_retry, SENSOR_MISSING);
+  } else if (corrupted) {
+    schedule_retry(therm_retry, SENSOR_CRC_ERROR);
+  }
+  return hasGoodValue;
 }
 
 /**********************************************************
@@ -305,6 +645,7 @@ Hardware::set_analog(byte value)
   if (value != Outputs.analog) {
     Outputs.analog = value;
     Outputs.attempts = NUM_SEND_ATTEMPTS;
+    Health.outputs_acknowledged = false;
   }
 }
 
@@ -314,6 +655,7 @@ Hardware::set_digital_1(byte value)
   if (value != Outputs.digital_1) {
     Outputs.digital_1 = value ? 1 : 0;
     Outputs.attempts = NUM_SEND_ATTEMPTS;
+    Health.outputs_acknowledged = false;
   }
 }
 
@@ -323,18 +665,69 @@ Hardware::set_digital_2(byte value)
   if (value != Outputs.digital_2) {
     Outputs.digital_2 = value ? 1 : 0;
     Outputs.attempts = NUM_SEND_ATTEMPTS;
+    Health.outputs_acknowledged = false;
+  }
+}
+
+/*
+ * Sends the outputs as a 2 byte frame with a 4 bit checksum. There's no way
+ * to tell if it was received, so it's sent NUM_SEND_ATTEMPTS times.
+ */
+bool
+Hardware::writeOutputsV1(byte payload)
+{
+  byte cksum = (Outputs.analog & 0x0F) ^ ((Outputs.analog & 0xF0) >> 4) ^
+               (payload & 0x0F);
+  byte frame[2] = { Outputs.analog, (byte)(payload | (cksum << 4)) };
+
+  int ret = i2c.write(I2C_SLAVE_ADDRESS, frame, 2);
+  if (ret != 0) {
+    DEBUG_MSG("Error updating output controller! I2c bus error %d.\n", ret);
+    return false;
+  }
+  Outputs.attempts--;
+  return true;
+}
+
+/*
+ * Sends the outputs as a 3 byte frame with a CRC-8, then reads back the
+ * state the controller applied. Once it matches, there's no need to resend.
+ */
+bool
+Hardware::writeOutputsV2(byte payload)
+{
+  byte frame[OUTPUT_V2_FRAME_LEN] = { Outputs.analog, payload };
+  frame[2] = crc8(frame, 2);
+  Outputs.attempts--;
+
+  int ret = i2c.write(I2C_SLAVE_ADDRESS, frame, OUTPUT_V2_FRAME_LEN);
+  if (ret != 0) {
+    DEBUG_MSG("Error updating output controller! I2c bus error %d.\n", ret);
+    return false;
+  }
+
+  // Read back the applied state
+  byte applied[OUTPUT_V2_FRAME_LEN];
+  byte len = i2c.read(I2C_SLAVE_ADDRESS, applied, OUTPUT_V2_FRAME_LEN);
+  if (len != OUTPUT_V2_FRAME_LEN) {
+    DEBUG_MSG("Error: output controller returned %d bytes, not %d.\n",
+              len,
+              OUTPUT_V2_FRAME_LEN);
+    return false;
+  }
+  if (memcmp(applied, frame, OUTPUT_V2_FRAME_LEN) != 0) {
+    DEBUG_MSG("Output controller state doesn't match what was sent.\n");
+    return false;
   }
+  Outputs.attempts = 0;
+  return true;
 }
 
 void
 Hardware::write_outputs()
 {
-  if (Outputs.attempts > 0) {
-    int ret;
+  if (Outputs.attempts > 0 && i2c.ready()) {
     byte payload = Outputs.digital_1 | (Outputs.digital_2 << 1);
-    byte cksum = (Outputs.analog & 0x0F) ^ ((Outputs.analog & 0xF0) >> 4) ^
-                 (payload & 0x0F);
-    payload = payload | (cksum << 4);
 
     DEBUG_MSG(
       "Writing outputs:\n  ANALOG: %d\n  DIGITAL 1: %d\n  DIGITAL 2: %d\n",
@@ -342,34 +735,124 @@ Hardware::write_outputs()
       Outputs.digital_1,
       Outputs.digital_2);
 
-    // Write out payload
-    Wire.beginTransmission(I2C_SLAVE_ADDRESS);
-    Wire.write(Outputs.analog);
-    Wire.write(payload);
-    ret = Wire.endTransmission();
-
-    if (ret == 0) {
-      Outputs.attempts--;
-    } else {
-      DEBUG_MSG("Error updating output controller! I2c bus error %d.\n", ret);
-      if (ret == 4) {
-        // status 4 indicates error with bus
-        reset_i2c_bus();
+    if (monitor_config->output_protocol == OUTPUT_PROTOCOL_V2) {
+      Health.outputs_acknowledged = writeOutputsV2(payload);
+      if (!Health.outputs_acknowledged && Outputs.attempts == 0) {
+        DEBUG_MSG("!!! Output controller never acknowledged outputs.\n");
       }
+    } else {
+      writeOutputsV1(payload);
     }
   }
 }
 
+/*
+ * Counters for the i2c and OneWire buses since startup.
+ */
+const BusHealth*
+Hardware::bus_health()
+{
+  return &Health;
+}
+
+/*
+ * Which channel each DS18B20 is pinned to. Load it before init.
+ */
+ProbeMap*
+Hardware::probe_map()
+{
+  return &channels;
+}
+
+/*
+ * Whether the output controller confirmed it applied the last outputs. Only
+ * available with OUTPUT_PROTOCOL_V2.
+ */
+bool
+Hardware::outputs_acknowledged()
+{
+  return Health.outputs_acknowledged;
+}
+
 SensorData
 Hardware::read_sensors(time_t now)
 {
-  if (now - reading.timestamp >= monitor_config->sample_interval) {
-    bool update_timestamp = readSHTsensor(reading, now);
-    update_timestamp |= readTempSensors(reading);
-    if (update_timestamp) {
-      // If either source updated, update the timestamp
-      reading.timestamp = now;
+  if (!sht_measuring && !therm_converting && !sht_retry.pending &&
+      !therm_retry.pending) {
+    // Only the sources that are due get sampled, starting with the first read
+    bool sht_due = !sht_sampled || now - sht_sampled >= sht_interval;
+    bool therm_due =
+      monitor_config->num_therm_sensors > 0 &&
+      (!therm_sampled || now - therm_sampled >= therm_interval);
+    if (!sht_due && !therm_due) {
+      if (monitor_config->num_therm_sensors > 0 &&
+          now - last_hotplug_check >= HOTPLUG_CHECK_INTERVAL) {
+        // Look for probe changes on a loop that isn't taking a sample
+        last_hotplug_check = now;
+        checkTempSensors();
+      }
+      return reading;
+    }
+    // Due sources are started together and collected into a pending
+    // sample, so their conversion times overlap instead of adding up.
+    pending = reading;
+    sample_updated = false;
+    sht_retry = {};
+    therm_retry = {};
+    if (sht_due) {
+      sht_sampled = now;
+      sample_updated = readSHTsensor(pending, now);
+    }
+    if (therm_due) {
+      if (!therm_sampled) {
+        // The bus was just searched by init
+        last_hotplug_check = now;
+      }
+      therm_sampled = now;
+      if (therm_rescan) {
+        // A sensor stopped responding, see if it's still on the bus
+        scanTempSensors();
+      }
+      startTempConversion();
+    }
+  }
+
+  // Collect from each source once its measurement is ready. A blocking
+  // conversion has already covered the SHT40's wait by the time it returns.
+  if (sht_measuring && millis() - sht_cmd_sent >= sht_read_delay) {
+    sample_updated |= collectSHTsensor(pending, now);
+  }
+  if (therm_converting &&
+      (!monitor_config->async_temp_reads ||
+       millis() - therm_conv_started >= CONVERSION_TIME(therm_resolution))) {
+    sample_updated |= readTempSensors(pending, now, false);
+  }
+
+  // Failed reads are tried again within the same sample, depending on why
+  // they failed.
+  if (retry_due(sht_retry)) {
+    sample_updated |= readSHTsensor(pending, now);
+  }
+  if (retry_due(therm_retry)) {
+    if (therm_rescan) {
+      scanTempSensors();
+      startTempConversion();
+    } else {
+      // The last conversion is still in the scratchpads
+      sample_updated |= readTempSensors(pending, now, true);
     }
   }
+
+  if (sht_measuring || therm_converting || sht_retry.pending ||
+      therm_retry.pending) {
+    // The previous reading is returned until both sources are done
+    return reading;
+  }
+  if (sample_updated) {
+    // If either source updated, update the timestamp. Each reading keeps its
+    // own timestamp for when it was last measured.
+    pending.timestamp = now;
+  }
+  reading = pending;
   return reading;
 }
@@ -7,19 +7,63 @@
 #ifndef HARDWARE_H
 #define HARDWARE_H
 
+#include "ProbeMap.h"
 #include "types.h"
 #include <time.h>
 
 #define I2C_SLAVE_ADDRESS 42
 #define NUM_SEND_ATTEMPTS 3
+#define OUTPUT_V2_FRAME_LEN 3
 
 #define SHT40_ADDRESS 0x44
-#define SHT40_READ_CMD 0xFD
-#define SHT40_HEATER_CMD 0x2F
+#define SHT40_READ_HIGH_CMD 0xFD
+// ms to wait between command and read: the datasheet max rounded up, plus 1
+// since a millis() wait can come up to 1ms short
+#define SHT40_READ_HIGH_DELAY 10
+#define SHT40_READ_MEDIUM_CMD 0xF6
+#define SHT40_READ_MEDIUM_DELAY 6
+#define SHT40_READ_LOW_CMD 0xE0
+#define SHT40_READ_LOW_DELAY 3
+#define SHT40_HEATER_HIGH_CMD 0x39    // 200mW for 1s
+#define SHT40_HEATER_HIGH_COOLDOWN 20 // s to wait before measuring again
+#define SHT40_HEATER_MEDIUM_CMD 0x2F  // 110mW for 1s
+#define SHT40_HEATER_MEDIUM_COOLDOWN 15
+#define SHT40_HEATER_LOW_CMD 0x24 // 110mW for 0.1s
+#define SHT40_HEATER_LOW_COOLDOWN 2
+#define SHT40_HEATER_RH 80      // Default RH to hold before running heater
+#define SHT40_HEATER_RH_STEP 10 // RH above threshold to use more power
+#define SHT40_SATURATED_RH 95
 #define HEAT_INTERVAL 300
 
-#define RESOLUTION 12
-#define ONE_WIRE_BUS 2 // D4
+#define MIN_RESOLUTION 9
+#define MAX_RESOLUTION 12
+// ms for a DS18B20 conversion: 750ms at 12 bits, halved for each bit less.
+// Rounded up, with 1ms extra for the same millis() granularity.
+#define CONVERSION_TIME(res)                                                   \
+  (((750 + (1 << (12 - (res))) - 1) >> (12 - (res))) + 1)
+// Fraction of the DS18B20 sample interval a conversion may take when picking
+// the resolution automatically.
+#define BLOCKING_CONVERSION_SHARE 8
+#define ASYNC_CONVERSION_SHARE 2
+#define ONE_WIRE_BUS 2             // D4, used when no buses are configured
+#define HOTPLUG_CHECK_INTERVAL 300 // s between looking for probe changes
+
+// Retries of a failed read within the same sample, by why it failed
+#define CRC_ERROR_RETRIES 2 // Retried right away
+#define BUS_ERROR_RETRIES 2
+#define BUS_ERROR_BACKOFF 50 // ms, doubled after each try
+#define MISSING_RETRIES 1    // Retried after a rescan
+
+/*
+ * Tracks the retries of a sensor source during a sample.
+ */
+typedef struct RetryState
+{
+  byte attempts;
+  bool pending;
+  unsigned long started;
+  unsigned long wait;
+} RetryState;
 
 /*
  * Interfaces to the sensors, as well as the output controller.
@@ -32,14 +76,55 @@ public:
   void set_digital_1(byte value);
   void set_digital_2(byte value);
   void write_outputs();
+  bool outputs_acknowledged();
+  const BusHealth* bus_health();
+  ProbeMap* probe_map();
   SensorData read_sensors(time_t now);
 
 private:
   VivariumMonitorConfig* monitor_config = NULL;
   time_t last_heated = 0;
+  time_t sht_cooldown = 0;
+  time_t rh_high_since = 0;
+  byte sht_read_cmd = SHT40_READ_HIGH_CMD;
+  unsigned long sht_read_delay = SHT40_READ_HIGH_DELAY;
+  bool sht_measuring = false;
+  unsigned long sht_cmd_sent = 0;
+  byte therm_addrs[MAX_THERM_SENSORS][8];
+  bool therm_found[MAX_THERM_SENSORS];
+  byte therm_bus[MAX_THERM_SENSORS];  // Bus each channel's sensor is on
+  byte scan_bus[MAX_THERM_SENSORS];   // Bus of each sensor, in bus order
+  byte scan_index[MAX_THERM_SENSORS]; // Index of each sensor on its bus
+  ProbeMap channels;
+  byte num_buses = 1;
+  byte bus_probes[MAX_ONE_WIRE_BUSES];
+  time_t last_hotplug_check = 0;
+  bool therm_rescan = false;
+  byte therm_resolution = MAX_RESOLUTION;
+  bool therm_converting = false;
+  unsigned long therm_conv_started = 0;
+  bool sample_updated = false;
+  unsigned int sht_interval;
+  unsigned int therm_interval;
+  RetryState sht_retry;
+  RetryState therm_retry;
+  time_t sht_sampled = 0;
+  time_t therm_sampled = 0;
   SensorData reading;
+  SensorData pending;
+  bool writeOutputsV1(byte payload);
+  bool writeOutputsV2(byte payload);
+  byte pickHeaterCmd(SensorReading& humidity, time_t now);
   bool readSHTsensor(SensorData& output, time_t now);
-  bool readTempSensors(SensorData& output);
+  bool collectSHTsensor(SensorData& output, time_t now);
+  byte pickTempResolution();
+  void setupTempBuses();
+  void mapTempSensors();
+  bool checkTempSensors();
+  void scanTempSensors();
+  void placeTempSensor(byte slot, byte bus, const byte* addr);
+  void startTempConversion();
+  bool readTempSensors(SensorData& output, time_t now, bool reread);
 };
 
 #endif
@@ -0,0 +1,256 @@
+/*
+ * I2CBus.cpp
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#include "I2CBus.h"
+#include "debug.h"
+
+#include <Arduino.h>
+#include <Wire.h>
+
+void
+record_transaction(BusStats& stats, unsigned long started)
+{
+  unsigned long latency = micros() - started;
+  stats.transactions++;
+  stats.latency_total += latency;
+  if (stats.transactions == 1 || latency < stats.latency_min) {
+    stats.latency_min = latency;
+  }
+  if (latency > stats.latency_max) {
+    stats.latency_max = latency;
+  }
+}
+
+void
+I2CBus::begin(unsigned long clock, BusStats* counters)
+{
+  bus_clock = clock;
+  stats = counters;
+  error_streak = 0;
+  recovery_state = BUS_OK;
+  Wire.begin();
+  configure();
+}
+
+/*
+ * Applies the clock speed and stretch limit, which Wire.begin() resets.
+ */
+void
+I2CBus::configure()
+{
+  Wire.setClock(bus_clock);
+  Wire.setClockStretchLimit(I2C_STRETCH_LIMIT);
+}
+
+/*
+ * Counts a failed transaction, slowing the bus down if they keep happening.
+ */
+void
+I2CBus::countError()
+{
+  error_streak++;
+  if (error_streak >= I2C_FALLBACK_ERRORS && bus_clock > I2C_STANDARD_CLOCK) {
+    DEBUG_MSG("%d i2c errors in a row, dropping to %dHz.\n",
+              error_streak,
+              I2C_STANDARD_CLOCK);
+    bus_clock = I2C_STANDARD_CLOCK;
+    configure();
+  }
+}
+
+/*
+ * Writes data to a device, retrying data NACKs and timeouts. Returns the
+ * status from Wire.endTransmission().
+ */
+byte
+I2CBus::write(byte address, const byte* data, byte len)
+{
+  byte status;
+  byte tries = 0;
+  do {
+    Wire.beginTransmission(address);
+    for (byte i = 0; i < len; i++) {
+      Wire.write(data[i]);
+    }
+    unsigned long started = micros();
+    status = Wire.endTransmission();
+    record_transaction(*stats, started);
+    if (status == 0) {
+      error_streak = 0;
+      return status;
+    }
+    if (status < BUS_FAILURE_CODES) {
+      stats->failures[status]++;
+    }
+    if (status == 4) {
+      // status 4 indicates error with bus
+      countError();
+      reset();
+      return status;
+    }
+    if (status == 2) {
+      // NACK on the address, the device isn't there
+      return status;
+    }
+    countError();
+  } while (tries++ < I2C_TRANSACTION_RETRIES);
+  return status;
+}
+
+/*
+ * Reads len bytes from a device into data. Returns the number of bytes read.
+ */
+byte
+I2CBus::read(byte address, byte* data, byte len)
+{
+  unsigned long started = micros();
+  byte got = Wire.requestFrom(address, len);
+  record_transaction(*stats, started);
+  if (got != len) {
+    stats->failures[0]++;
+    countError();
+  } else {
+    error_streak = 0;
+  }
+  for (byte i = 0; i < got; i++) {
+    data[i] = Wire.read();
+  }
+  return got;
+}
+
+/*
+ * Counts data that was read but failed its CRC.
+ */
+void
+I2CBus::corrupted()
+{
+  stats->crc_failures++;
+  countError();
+}
+
+/*
+ * Clearing a stuck i2c bus is done as a state machine, so that it can be
+ * stepped through a little at a time without freezing the rest of the loop.
+ *
+ * Code in these functions adapted from:
+ *   https://www.forward.com.au/pfod/ArduinoProgramming/I2C_ClearBus/index.html
+ *   Written by Matthew Ford, released into open domain.
+ */
+void
+I2CBus::finishReset()
+{
+  // Hand the pins back to Wire. Even if the bus couldn't be cleared, the next
+  // transaction gets a chance to try it again.
+  Wire.begin();
+  configure();
+  recovery_state = BUS_OK;
+}
+
+bool
+I2CBus::ready()
+{
+  unsigned long started = micros();
+  while (recovery_state != BUS_OK) {
+    if (micros() - started >= I2C_RECOVERY_BUDGET) {
+      // Out of time, pick back up on the next call
+      return false;
+    }
+
+    switch (recovery_state) {
+      case BUS_START:
+        // Manually control I2C pins
+        pinMode(SDA, INPUT_PULLUP);
+        pinMode(SCL, INPUT_PULLUP);
+
+        // Check SCL is not held low
+        if (digitalRead(SCL) == LOW) {
+          DEBUG_MSG(
+            "I2C bus error. Could not clear sclPin clock line held low\n");
+          finishReset();
+          break;
+        }
+        clocks_left = I2C_RECOVERY_CLOCKS;
+        recovery_state = BUS_CLOCKING;
+        break;
+
+      case BUS_CLOCKING:
+        if (digitalRead(SDA) != LOW) {
+          recovery_state = BUS_STOP;
+          break;
+        }
+        if (clocks_left == 0) {
+          DEBUG_MSG(
+            "I2C bus error. Could not clear. sdaPin data line held low\n");
+          finishReset();
+          break;
+        }
+        clocks_left--;
+        // Note: I2C bus is open collector so do NOT drive sclPin or sdaPin
+        // high.
+        pinMode(SCL, INPUT); // release sclPin pullup so that when made output
+                             // it will be LOW
+        pinMode(SCL, OUTPUT);       // then clock sclPin Low
+        delayMicroseconds(10);      //  for >5us
+        pinMode(SCL, INPUT);        // release sclPin LOW
+        pinMode(SCL, INPUT_PULLUP); // turn on pullup resistors again
+        // do not force high as slave may be holding it low for clock
+        // stretching.
+        delayMicroseconds(
+          10); //  for >5u so that even the slowest I2C devices are handled.
+        wait_started = millis();
+        recovery_state = BUS_WAIT_SCL;
+        break;
+
+      case BUS_WAIT_SCL:
+        // wait for sclPin to become High, across calls, only wait 2sec.
+        if (digitalRead(SCL) == LOW) {
+          if (millis() - wait_started >= I2C_RECOVERY_SCL_WAIT) {
+            DEBUG_MSG("I2C bus error. Could not clear. sclPin clock line held "
+                      "low by slave clock stretch for >2sec\n");
+            finishReset();
+            break;
+          }
+          return false;
+        }
+        recovery_state = BUS_CLOCKING;
+        break;
+
+      case BUS_STOP:
+        // pull sdaPin line low for Start or Repeated Start
+        pinMode(SDA, INPUT);  // remove pullup.
+        pinMode(SDA, OUTPUT); // and then make it LOW i.e. send an I2C Start or
+                              // Repeated start control.
+        // When there is only one I2C master a Start or Repeat Start has the
+        // same function as a Stop and clears the bus. A Repeat Start is a
+        // Start occurring after a Start with no intervening Stop.
+        delayMicroseconds(10); // wait >5us
+        pinMode(SDA, INPUT);   // remove output low
+        // and make sdaPin high i.e. send I2C STOP control.
+        pinMode(SDA, INPUT_PULLUP);
+        delayMicroseconds(10); // x. wait >5us
+        pinMode(SDA, INPUT_PULLUP); // Make sdaPin (data) and sclPin (clock)
+                                    // pins Inputs with pullup.
+        pinMode(SCL, INPUT_PULLUP);
+        finishReset();
+        break;
+
+      default:
+        break;
+    }
+  }
+  return true;
+}
+
+void
+I2CBus::reset()
+{
+  if (recovery_state == BUS_OK) {
+    DEBUG_MSG("Resetting i2c bus...\n");
+    recovery_state = BUS_START;
+    stats->resets++;
+  }
+  ready();
+}
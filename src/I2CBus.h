@@ -0,0 +1,63 @@
+/*
+ * I2CBus.h
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#ifndef I2CBUS_H
+#define I2CBUS_H
+
+#include "types.h"
+
+#define I2C_STANDARD_CLOCK 100000 // Hz
+#define I2C_FAST_CLOCK 400000
+#define I2C_FALLBACK_ERRORS 3     // Errors in a row before dropping to 100kHz
+#define I2C_STRETCH_LIMIT 1500    // us a device can hold SCL before timing out
+#define I2C_TRANSACTION_RETRIES 1 // For data NACKs and timeouts
+
+#define I2C_RECOVERY_BUDGET 1000 // us to spend clearing the bus per call
+#define I2C_RECOVERY_CLOCKS 20
+#define I2C_RECOVERY_SCL_WAIT 2000 // ms
+
+/*
+ * Counts a bus transaction that started at the given micros() time. Also
+ * used for the OneWire bus.
+ */
+void record_transaction(BusStats& stats, unsigned long started);
+
+/*
+ * Owns the Wire configuration and every transaction on the i2c bus: clock
+ * speed, timeouts, retries, recovering a stuck bus, and the bus counters.
+ */
+class I2CBus
+{
+public:
+  void begin(unsigned long clock, BusStats* counters);
+  bool ready();
+  void reset();
+  byte write(byte address, const byte* data, byte len);
+  byte read(byte address, byte* data, byte len);
+  void corrupted();
+
+private:
+  enum RecoveryState
+  {
+    BUS_OK,
+    BUS_START,
+    BUS_CLOCKING,
+    BUS_WAIT_SCL,
+    BUS_STOP,
+  };
+
+  BusStats* stats = NULL;
+  unsigned long bus_clock = I2C_STANDARD_CLOCK;
+  byte error_streak = 0;
+  RecoveryState recovery_state = BUS_OK;
+  byte clocks_left = 0;
+  unsigned long wait_started = 0;
+  void configure();
+  void finishReset();
+  void countError();
+};
+
+#endif
@@ -7,19 +7,37 @@
 #include "Network.h"
 #include "debug.h"
 
+#include <Arduino.h>
 #include <ESP8266WiFi.h>
 #include <LittleFS.h>
 #include <StreamUtils.h>
 #include <Updater.h>
+#include <lwip/dns.h>
 
 /**********************************************************
  * Global vars
  **********************************************************/
 WiFiServer web_server(80);
+WiFiClient stats_client;        // Kept open between posts if the server allows
+char json_buffer[JSONBUF_SIZE]; // Too big for the stack
+char stats_header[STATS_HEADER_SIZE];
+
+/*
+ * The stats server's address lookup, which lwIP answers in the background
+ */
+struct
+{
+  volatile bool pending;
+  volatile unsigned long ip; // 0 if the server wasn't found
+} stats_lookup;
 
 /************************************************************
  * Utility functions
  ************************************************************/
+/*
+ * Reads an HTTP response's status and headers, then hands a 200 response's
+ * body to the callback.
+ */
 int
 getHttpResult(WiFiClient& wifi, void (*callback)(Stream&, size_t) = NULL)
 {
@@ -42,7 +60,7 @@ getHttpResult(WiFiClient& wifi, void (*callback)(Stream&, size_t) = NULL)
 
   bufferedWifi.find("\n");
   while (bufferedWifi.available()) {
-    if (strcmp(buf, "Content-Length") == 0) {
+    if (strcasecmp(buf, "Content-Length") == 0) {
       len = bufferedWifi.parseInt();
       isheader = true;
       DEBUG_MSG("Content length: %d\n", len);
@@ -68,6 +86,281 @@ getHttpResult(WiFiClient& wifi, void (*callback)(Stream&, size_t) = NULL)
   return ret;
 }
 
+/*
+ * Marks a reading as an error if it was measured more than max_age seconds
+ * before the sample it's part of.
+ */
+void
+drop_stale_reading(SensorReading& reading, time_t sampled, time_t max_age)
+{
+  if (!reading.error && reading_age(reading, sampled) > max_age) {
+    DEBUG_MSG("Dropping reading from %d, it's too old.\n", reading.timestamp);
+    reading.error = SENSOR_STALE;
+  }
+}
+
+void
+add_running_stat(RunningStats& stats, float value)
+{
+  stats.count++;
+  if (stats.count == 1 || value < stats.min) {
+    stats.min = value;
+  }
+  if (stats.count == 1 || value > stats.max) {
+    stats.max = value;
+  }
+  float delta = value - stats.mean;
+  stats.mean += delta / stats.count;
+  stats.m2 += delta * (value - stats.mean);
+}
+
+void
+merge_running_stats(RunningStats& stats, const RunningStats& other)
+{
+  if (!other.count) {
+    return;
+  }
+  if (!stats.count) {
+    stats = other;
+    return;
+  }
+  unsigned long count = stats.count + other.count;
+  float delta = other.mean - stats.mean;
+  stats.mean += delta * other.count / count;
+  stats.m2 += other.m2 + delta * delta * stats.count * other.count / count;
+  stats.min = other.min < stats.min ? other.min : stats.min;
+  stats.max = other.max > stats.max ? other.max : stats.max;
+  stats.count = count;
+}
+
+/*
+ * Adds every channel's running stats into another sample's.
+ */
+void
+merge_sample_stats(SampleStats& stats, const SampleStats& other)
+{
+  merge_running_stats(stats.humidity, other.humidity);
+  merge_running_stats(stats.air_temp, other.air_temp);
+  merge_running_stats(stats.high_temp, other.high_temp);
+  merge_running_stats(stats.low_temp, other.low_temp);
+  for (int i = 0; i < MAX_THERM_SENSORS; i++) {
+    merge_running_stats(stats.probes[i], other.probes[i]);
+  }
+}
+
+float
+running_variance(const RunningStats& stats)
+{
+  return stats.count > 1 ? stats.m2 / (stats.count - 1) : 0;
+}
+
+/*
+ * Called by lwIP once the stats server's address lookup is done.
+ */
+void
+stats_host_found(const char* name, const ip_addr_t* addr, void* arg)
+{
+  stats_lookup.ip = addr ? (unsigned long)IPAddress(addr) : 0;
+  stats_lookup.pending = false;
+}
+
+/*
+ * Copies a sample and the outputs into a stats entry.
+ */
+void
+fill_entry(StatsEntry& entry,
+           SensorData& sample,
+           byte digital_1,
+           byte digital_2,
+           byte analog)
+{
+  SensorReading* readings[STATS_PROBES] = {
+    &sample.high_temp, &sample.low_temp, &sample.air_temp, &sample.humidity
+  };
+  entry.timestamp = sample.timestamp;
+  entry.num_probes = sample.num_probes < MAX_THERM_SENSORS ? sample.num_probes
+                                                           : MAX_THERM_SENSORS;
+  entry.valid = 0;
+  for (byte i = 0; i < STATS_PROBES + entry.num_probes; i++) {
+    SensorReading& reading =
+      i < STATS_PROBES ? *readings[i] : sample.probes[i - STATS_PROBES];
+    entry.values[i] = reading.value;
+    if (!reading.error) {
+      entry.valid |= 1UL << i;
+    }
+  }
+  entry.digital_1 = digital_1;
+  entry.digital_2 = digital_2;
+  entry.analog = analog;
+}
+
+/*
+ * Formats one of a stats entry's values as a JSON value, null if it had an
+ * error.
+ */
+void
+format_value(char* buf, size_t len, const StatsEntry& entry, byte index)
+{
+  if (entry.valid & (1UL << index))
+    snprintf(buf, len, "%.2f", entry.values[index]);
+  else
+    snprintf(buf, len, "null");
+}
+
+/*
+ * Formats a stats entry as a JSON object, leaving it open so more members
+ * can be added.
+ */
+size_t
+format_entry(char* buf, size_t len, const StatsEntry& entry)
+{
+  size_t size = snprintf(
+    buf, len, "{\"id\":%d,\"timestamp\":\"", ESP.getChipId());
+  size += strftime(
+    buf + size, 20, "%Y-%m-%dT%H:%M:%S", localtime(&entry.timestamp));
+
+  char high_temp[VALUE_JSON_SIZE];
+  char low_temp[VALUE_JSON_SIZE];
+  char air_temp[VALUE_JSON_SIZE];
+  char humidity[VALUE_JSON_SIZE];
+  format_value(high_temp, VALUE_JSON_SIZE, entry, STATS_HIGH_TEMP);
+  format_value(low_temp, VALUE_JSON_SIZE, entry, STATS_LOW_TEMP);
+  format_value(air_temp, VALUE_JSON_SIZE, entry, STATS_AIR_TEMP);
+  format_value(humidity, VALUE_JSON_SIZE, entry, STATS_HUMIDITY);
+  size += snprintf(
+    buf + size,
+    len - size,
+    "\",\"high_temp\":%s,\"low_temp\":%s,\"air_temp\":%s,\"humidity\":%s,"
+    "\"probes\":[",
+    high_temp,
+    low_temp,
+    air_temp,
+    humidity);
+  for (int i = 0; i < entry.num_probes && i < MAX_THERM_SENSORS; i++) {
+    char probe[VALUE_JSON_SIZE];
+    format_value(probe, VALUE_JSON_SIZE, entry, STATS_PROBES + i);
+    size += snprintf(buf + size, len - size, i > 0 ? ",%s" : "%s", probe);
+  }
+  size += snprintf(buf + size,
+                   len - size,
+                   "],\"digital_1\":%d,\"digital_2\":%d,\"analog\":%d",
+                   entry.digital_1,
+                   entry.digital_2,
+                   entry.analog);
+  return size;
+}
+
+/*
+ * Adds a reading to its channel's running stats, if it was measured since
+ * the last sample that was added.
+ */
+void
+aggregate_reading(RunningStats& stats, SensorReading& reading, time_t since)
+{
+  if (!reading.error && reading.timestamp > since) {
+    add_running_stat(stats, reading.value);
+  }
+}
+
+/*
+ * Formats a channel's running stats as a JSON array of count, min, max, mean
+ * and variance, null if it has no readings.
+ */
+size_t
+format_running_stat(char* buf, size_t len, const RunningStats& stats)
+{
+  if (!stats.count) {
+    return snprintf(buf, len, "null");
+  }
+  return snprintf(buf,
+                  len,
+                  "[%lu,%.2f,%.2f,%.2f,%.2f]",
+                  stats.count,
+                  stats.min,
+                  stats.max,
+                  stats.mean,
+                  running_variance(stats));
+}
+
+/*
+ * Formats a bus's health counters as a JSON member.
+ */
+size_t
+format_bus_stats(char* buf,
+                 size_t len,
+                 const char* name,
+                 const BusStats& stats)
+{
+  return snprintf(buf,
+                  len,
+                  ",\"%s\":{\"n\":%lu,\"fail\":[%lu,%lu,%lu,%lu,%lu,%lu],"
+                  "\"crc\":%lu,\"resets\":%lu,\"us\":[%lu,%lu,%lu]}",
+                  name,
+                  stats.transactions,
+                  stats.failures[0],
+                  stats.failures[1],
+                  stats.failures[2],
+                  stats.failures[3],
+                  stats.failures[4],
+                  stats.failures[5],
+                  stats.crc_failures,
+                  stats.resets,
+                  stats.latency_min,
+                  stats.transactions ? stats.latency_total / stats.transactions
+                                     : 0,
+                  stats.latency_max);
+}
+
+/*
+ * Prints an endpoint's breaker state as a list item on the status page.
+ */
+void
+print_endpoint_health(WriteBufferingStream& out,
+                      const char* name,
+                      const EndpointHealth& health)
+{
+  static const char* states[] = { "closed", "open", "half-open" };
+  out.printf("<li><b>%s breaker:</b> %s, %u failures",
+             name,
+             states[health.state()],
+             health.failures());
+  if (health.state() != BREAKER_HALF_OPEN && health.retryAt()) {
+    out.printf(", next try <span class=\"time\">%ld</span>",
+               (long)health.retryAt());
+  }
+  out.print(F("</li>"));
+}
+
+/*
+ * Prints a bus's health counters as a list item on the status page.
+ */
+void
+print_bus_stats(WriteBufferingStream& out,
+                const char* name,
+                const BusStats& stats)
+{
+  unsigned long failed = 0;
+  for (int i = 0; i < BUS_FAILURE_CODES; i++) {
+    failed += stats.failures[i];
+  }
+  out.printf("<li><b>%s bus:</b> %lu transactions, %lu failed (%lu/%lu/%lu/"
+             "%lu/%lu/%lu), %lu CRC errors, %lu resets, %lu/%lu/%lu us</li>",
+             name,
+             stats.transactions,
+             failed,
+             stats.failures[0],
+             stats.failures[1],
+             stats.failures[2],
+             stats.failures[3],
+             stats.failures[4],
+             stats.failures[5],
+             stats.crc_failures,
+             stats.resets,
+             stats.latency_min,
+             stats.transactions ? stats.latency_total / stats.transactions : 0,
+             stats.latency_max);
+}
+
 void
 do_fw_upgrade(Stream& wifi, size_t len)
 {
@@ -107,15 +400,26 @@ do_fw_upgrade(Stream& wifi, size_t len)
  * Public functions
  **********************************************************/
 void
-Network::init(VivariumMonitorConfig* config, Url update_endpoint)
+Network::init(VivariumMonitorConfig* config,
+              Url update_endpoint,
+              const BusHealth* health)
 {
   monitor_config = config;
   update_url = update_endpoint;
+  bus_health = health;
   last_collected.timestamp = 0;
-  last_collected.humidity.has_error = true;
-  last_collected.air_temp.has_error = true;
-  last_collected.high_temp.has_error = true;
-  last_collected.low_temp.has_error = true;
+  last_collected.humidity.error = SENSOR_NOT_READ;
+  last_collected.air_temp.error = SENSOR_NOT_READ;
+  last_collected.high_temp.error = SENSOR_NOT_READ;
+  last_collected.low_temp.error = SENSOR_NOT_READ;
+  last_collected.num_probes = 0;
+  memset(&aggregates, 0, sizeof(aggregates));
+  last_aggregated = 0;
+  batch_start = 0;
+  batch_count = 0;
+  request.state = STATS_IDLE;
+  stats_health.init(STATS_BACKOFF_SECONDS, STATS_COOLDOWN_SECONDS);
+  update_health.init(FIRMWARE_BACKOFF_SECONDS, FIRMWARE_COOLDOWN_SECONDS);
   web_server.begin();
 }
 
@@ -128,13 +432,17 @@ Network::update_firmware(time_t now)
   WiFiClient wifi;
   int status_code;
 
-  if (now - last_fw_check < FIRMWARE_CHECK_SECONDS || !update_url.set) {
+  // After a failure the backoff decides when to check again
+  if ((!update_health.failures() &&
+       now - last_fw_check < FIRMWARE_CHECK_SECONDS) ||
+      !update_url.set || !update_health.ready(now)) {
     return;
   }
   last_fw_check = now;
   DEBUG_MSG("Checking for updates...\n");
   if (!wifi.connect(update_url.host, update_url.port)) {
     DEBUG_MSG("Unable to connect to server.\n");
+    update_health.failure(now);
     return;
   }
   // Send HTTP request
@@ -150,6 +458,11 @@ Network::update_firmware(time_t now)
   }
 
   status_code = getHttpResult(wifi, do_fw_upgrade);
+  if (status_code < 0 || status_code >= 500) {
+    update_health.failure(now);
+  } else {
+    update_health.success();
+  }
   if (status_code == 304) {
     DEBUG_MSG("No new firmware version.\n");
   } else if (status_code != 200) {
@@ -193,6 +506,7 @@ Network::serve_web_interface()
                             update_url.host,
                             update_url.port,
                             update_url.path);
+          print_endpoint_health(client_out, "Update", update_health);
         } else {
           client_out.print(F("Not set</li>"));
         }
@@ -202,6 +516,9 @@ Network::serve_web_interface()
                             monitor_config->stats_url.host,
                             monitor_config->stats_url.port,
                             monitor_config->stats_url.path);
+          client_out.printf("<li><b>Unsent reports:</b> %lu</li>",
+                            spool.size());
+          print_endpoint_health(client_out, "Report", stats_health);
         } else {
           client_out.print(F("Not set</li>"));
         }
@@ -209,6 +526,16 @@ Network::serve_web_interface()
                           monitor_config->num_therm_sensors);
         client_out.printf("<li><b>Hygrometer: </b>%s</li>",
                           monitor_config->has_sht_sensor ? "Yes" : "No");
+        if (bus_health) {
+          print_bus_stats(client_out, "I2C", bus_health->i2c);
+          print_bus_stats(client_out, "OneWire", bus_health->onewire);
+          client_out.printf("<li><b>Probe changes:</b> %lu</li>",
+                            bus_health->probe_changes);
+          if (monitor_config->output_protocol == OUTPUT_PROTOCOL_V2) {
+            client_out.printf("<li><b>Outputs acknowledged:</b> %s</li>",
+                              bus_health->outputs_acknowledged ? "Yes" : "No");
+          }
+        }
         client_out.print(FPSTR(http_root_footer));
 
       } else if (strcmp("/rb?", pathbuf) == 0) {
@@ -245,26 +572,61 @@ Network::serve_web_interface()
   }
 }
 
+/*
+ * Adds the readings measured since the last sample to the running stats.
+ */
+void
+Network::aggregate(SensorData& readings)
+{
+  if (readings.timestamp <= last_aggregated) {
+    return;
+  }
+  aggregate_reading(aggregates.humidity, readings.humidity, last_aggregated);
+  aggregate_reading(aggregates.air_temp, readings.air_temp, last_aggregated);
+  aggregate_reading(aggregates.high_temp, readings.high_temp, last_aggregated);
+  aggregate_reading(aggregates.low_temp, readings.low_temp, last_aggregated);
+  for (unsigned int i = 0; i < readings.num_probes && i < MAX_THERM_SENSORS;
+       i++) {
+    aggregate_reading(
+      aggregates.probes[i], readings.probes[i], last_aggregated);
+  }
+  last_aggregated = readings.timestamp;
+}
+
 /*
  * Posts stats to an endpoint.
  */
 void
-Network::post_stats(SensorData& readings,
+Network::post_stats(SensorData& sample,
                     byte digital_1,
                     byte digital_2,
                     byte analog)
 {
-  WiFiClient wifi;
-  struct tm* timeinfo;
-  char json_buffer[JSONBUF_SIZE];
-  size_t json_size;
+  // Readings that haven't been measured in a while are treated as missing
+  SensorData readings = sample;
+  unsigned int interval = monitor_config->sht_interval
+                            ? monitor_config->sht_interval
+                            : monitor_config->sample_interval;
+  time_t max_age = STALE_READING_INTERVALS * interval;
+  drop_stale_reading(readings.humidity, readings.timestamp, max_age);
+  drop_stale_reading(readings.air_temp, readings.timestamp, max_age);
+  interval = monitor_config->therm_interval ? monitor_config->therm_interval
+                                            : monitor_config->sample_interval;
+  max_age = STALE_READING_INTERVALS * interval;
+  drop_stale_reading(readings.high_temp, readings.timestamp, max_age);
+  drop_stale_reading(readings.low_temp, readings.timestamp, max_age);
+  for (unsigned int i = 0; i < readings.num_probes; i++) {
+    drop_stale_reading(readings.probes[i], readings.timestamp, max_age);
+  }
+
+  aggregate(readings);
 
   // If there are no errors, collect this sample
   if (last_collected.timestamp < readings.timestamp &&
       (!monitor_config->has_sht_sensor ||
-       !(readings.humidity.has_error || readings.air_temp.has_error)) &&
+       !(readings.humidity.error || readings.air_temp.error)) &&
       (monitor_config->num_therm_sensors == 0 ||
-       !(readings.high_temp.has_error || readings.low_temp.has_error))) {
+       !(readings.high_temp.error || readings.low_temp.error))) {
     last_collected = readings;
     DEBUG_MSG("Caching sensor data at %d:\n  humidity: %.2f\n  air T: "
               "%.2f\n  high T: %.2f\n  low T: %.2f\n",
@@ -275,14 +637,22 @@ Network::post_stats(SensorData& readings,
               last_collected.low_temp.value);
   }
 
-  if (readings.timestamp - last_sent < monitor_config->stats_interval ||
-      !monitor_config->stats_url.set) {
+  if (!monitor_config->stats_url.set) {
+    return;
+  }
+  if (request.state != STATS_IDLE) {
+    // Only one request at a time, the next sample can wait
+    runStats();
+    return;
+  }
+  if (readings.timestamp - last_sent < monitor_config->stats_interval) {
+    // Catch up on samples from an outage between live posts
+    if (stats_accepted &&
+        readings.timestamp - last_drained >= SPOOL_DRAIN_SECONDS) {
+      drainSpool(readings.timestamp);
+    }
     return;
   }
-  DEBUG_MSG("Sending stats to http://%s:%d%s\n",
-            monitor_config->stats_url.host,
-            monitor_config->stats_url.port,
-            monitor_config->stats_url.path);
 
   // Deciede what value to send
   SensorData* toSend = &last_collected;
@@ -294,68 +664,507 @@ Network::post_stats(SensorData& readings,
               last_collected.timestamp,
               last_sent);
   }
+  StatsEntry entry;
+  fill_entry(entry, *toSend, digital_1, digital_2, analog);
+  last_sent = toSend->timestamp;
+
+  bool batched = monitor_config->stats_batch_size > 1;
+  if (batched) {
+    addToBatch(entry);
+    StatsEntry& oldest = batch[batch_start];
+    if (batch_count < monitor_config->stats_batch_size &&
+        batch_count < STATS_BATCH_CAPACITY &&
+        (!monitor_config->stats_batch_seconds ||
+         entry.timestamp - oldest.timestamp <
+           monitor_config->stats_batch_seconds)) {
+      return;
+    }
+  }
+  if (!stats_health.ready(readings.timestamp)) {
+    DEBUG_MSG("Stats server is down, not trying again until %d.\n",
+              stats_health.retryAt());
+    if (!batched) {
+      // Batches keep their samples until they're sent, or full
+      spool.push(entry);
+    }
+    return;
+  }
 
   // populate json buffer
-  timeinfo = localtime(&toSend->timestamp);
-  json_size = snprintf(
-    json_buffer, JSONBUF_SIZE, "{\"id\":%d,\"timestamp\":\"", ESP.getChipId());
-  json_size +=
-    strftime(json_buffer + json_size, 20, "%Y-%m-%dT%H:%M:%S", timeinfo);
-
-  char high_temp[7];
-  char low_temp[7];
-  char air_temp[7];
-  char humidity[7];
-  if (toSend->high_temp.has_error)
-    strcpy(high_temp, "null");
-  else
-    sprintf(high_temp, "%.2f", toSend->high_temp.value);
-  if (toSend->low_temp.has_error)
-    strcpy(low_temp, "null");
-  else
-    sprintf(low_temp, "%.2f", toSend->low_temp.value);
-  if (toSend->air_temp.has_error)
-    strcpy(air_temp, "null");
-  else
-    sprintf(air_temp, "%.2f", toSend->air_temp.value);
-  if (toSend->humidity.has_error)
-    strcpy(humidity, "null");
-  else
-    sprintf(humidity, "%.2f", toSend->humidity.value);
-  json_size += snprintf(
-    json_buffer + json_size,
-    JSONBUF_SIZE - json_size,
-    "\",\"high_temp\":%s,\"low_temp\":%s,\"air_temp\":%s,\"humidity\":%s,"
-    "\"digital_1\":%d,\"digital_2\":%d,\"analog\":%d}",
-    high_temp,
-    low_temp,
-    air_temp,
-    humidity,
-    digital_1,
-    digital_2,
-    analog);
+  size_t json_size;
+  if (batched) {
+    json_size = formatBatch(json_buffer, JSONBUF_SIZE);
+  } else {
+    json_size = format_entry(json_buffer, JSONBUF_SIZE, entry);
+    json_size += formatReport(
+      json_buffer + json_size, JSONBUF_SIZE - json_size, entry.num_probes);
+    json_size +=
+      snprintf(json_buffer + json_size, JSONBUF_SIZE - json_size, "}");
+  }
+  // Samples that come in while the request is out go in the next report
+  sent_aggregates = aggregates;
+  memset(&aggregates, 0, sizeof(aggregates));
+  DEBUG_MSG("Sending stats to http://%s:%d%s\n",
+            monitor_config->stats_url.host,
+            monitor_config->stats_url.port,
+            monitor_config->stats_url.path);
 
-  if (!wifi.connect(monitor_config->stats_url.host,
-                    monitor_config->stats_url.port)) {
-    DEBUG_MSG("Unable to connect to server.\n");
+  request.entry = entry;
+  startStats(STATS_LIVE, json_size, readings.timestamp);
+}
+
+/*
+ * Starts sending the oldest spooled samples, which are removed once the
+ * server has them.
+ */
+void
+Network::drainSpool(time_t now)
+{
+  StatsEntry entries[SPOOL_DRAIN_ENTRIES];
+  last_drained = now;
+  if (!spool.size()) {
     return;
   }
-  // Send HTTP request
-  if (wifi.connected()) {
-    WriteBufferingStream bufferedWifi(wifi, 64);
-    bufferedWifi.printf("POST %s HTTP/1.0\r\nHost: %s:%d\r\nUser-Agent: "
-                        "VivMonitor1.0\r\nConnection: close\r\nContent-type: "
-                        "application/json\r\nContent-Length: %d\r\n\r\n",
-                        monitor_config->stats_url.path,
-                        monitor_config->stats_url.host,
-                        monitor_config->stats_url.port,
-                        json_size);
-    bufferedWifi.write(json_buffer, json_size);
-    bufferedWifi.flush();
+  byte count = spool.peek(entries, SPOOL_DRAIN_ENTRIES);
+  if (!count) {
+    return;
+  }
+  DEBUG_MSG("Sending %d spooled samples.\n", count);
+  size_t json_size = snprintf(json_buffer, JSONBUF_SIZE, "[");
+  for (byte i = 0; i < count; i++) {
+    json_size += format_entry(
+      json_buffer + json_size, JSONBUF_SIZE - json_size, entries[i]);
+    json_size += snprintf(json_buffer + json_size,
+                          JSONBUF_SIZE - json_size,
+                          i == count - 1 ? "}]" : "},");
+  }
+
+  request.drain_count = count;
+  startStats(STATS_DRAIN, json_size, now);
+}
+
+/*
+ * Starts posting the JSON in json_buffer, on the kept connection if there is
+ * one.
+ */
+void
+Network::startStats(byte kind, size_t len, time_t now)
+{
+  request.kind = kind;
+  request.started = now;
+  request.body_len = len;
+  request.header_len =
+    snprintf(stats_header,
+             STATS_HEADER_SIZE,
+             "POST %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: "
+             "VivMonitor1.0\r\nConnection: keep-alive\r\n"
+             "Content-type: application/json\r\nContent-Length: "
+             "%u\r\n\r\n",
+             monitor_config->stats_url.path,
+             monitor_config->stats_url.host,
+             monitor_config->stats_url.port,
+             (unsigned int)len);
+  request.retried = false;
+  request.resolving = false;
+  request.reused = stats_client.connected();
+  if (request.reused) {
+    beginStatsWrite();
   } else {
-    DEBUG_MSG("Connection failed before a request could be made.\n");
+    request.state = STATS_RESOLVE;
   }
+  runStats();
+}
 
-  wifi.stop();
-  last_sent = toSend->timestamp;
+/*
+ * Moves the stats request forward until it has to wait on the network, or
+ * runs out of time.
+ */
+void
+Network::runStats()
+{
+  unsigned long started = micros();
+  while (request.state != STATS_IDLE &&
+         micros() - started < STATS_STEP_BUDGET) {
+    if (!stepStats()) {
+      break;
+    }
+  }
+}
+
+/*
+ * Does the next bit of the stats request. Returns false if there was nothing
+ * to do yet.
+ */
+bool
+Network::stepStats()
+{
+  switch (request.state) {
+    case STATS_RESOLVE:
+      if (!stats_ip) {
+        if (!request.resolving) {
+          ip_addr_t addr;
+          request.resolving = true;
+          request.since = millis();
+          stats_lookup.pending = true;
+          stats_lookup.ip = 0;
+          err_t err = dns_gethostbyname(
+            monitor_config->stats_url.host, &addr, stats_host_found, NULL);
+          if (err != ERR_INPROGRESS) {
+            // Answered from the cache, or the name is no good
+            stats_lookup.ip =
+              err == ERR_OK ? (unsigned long)IPAddress(&addr) : 0;
+            stats_lookup.pending = false;
+          }
+        }
+        if (stats_lookup.pending) {
+          if (millis() - request.since < STATS_RESOLVE_TIMEOUT) {
+            return false;
+          }
+          stats_lookup.pending = false;
+        }
+        request.resolving = false;
+        if (!stats_lookup.ip) {
+          DEBUG_MSG("Unable to resolve %s.\n", monitor_config->stats_url.host);
+          finishStats(-1);
+          return true;
+        }
+        stats_ip = stats_lookup.ip;
+      }
+      request.state = STATS_CONNECT;
+      return true;
+    case STATS_CONNECT:
+      stats_client.setTimeout(STATS_CONNECT_TIMEOUT);
+      if (!stats_client.connect(IPAddress(stats_ip),
+                                monitor_config->stats_url.port)) {
+        DEBUG_MSG("Unable to connect to server.\n");
+        // Look the server up again next time, in case it moved
+        stats_ip = 0;
+        finishStats(-1);
+        return true;
+      }
+      beginStatsWrite();
+      return true;
+    case STATS_WRITE:
+      return writeStats();
+    case STATS_READ:
+      return readStats();
+  }
+  return false;
+}
+
+/*
+ * Starts writing the request on the open connection.
+ */
+void
+Network::beginStatsWrite()
+{
+  request.state = STATS_WRITE;
+  request.since = millis();
+  request.sent = 0;
+  request.closed = false;
+  request.answered = false;
+  request.status = -1;
+  request.keep_alive = false;
+  request.in_body = false;
+  request.has_length = false;
+  request.chunked = false;
+  request.last_chunk = false;
+  request.remaining = 0;
+  request.line_len = 0;
+}
+
+/*
+ * Writes as much of the request as the connection has room for.
+ */
+bool
+Network::writeStats()
+{
+  size_t total = request.header_len + request.body_len;
+  size_t room = stats_client.availableForWrite();
+  size_t len;
+  const char* data;
+  if (request.sent < request.header_len) {
+    data = stats_header + request.sent;
+    len = request.header_len - request.sent;
+  } else {
+    data = json_buffer + request.sent - request.header_len;
+    len = total - request.sent;
+  }
+  if (len > room) {
+    len = room;
+  }
+  if (len) {
+    len = stats_client.write((const uint8_t*)data, len);
+  }
+  if (!len) {
+    if (!stats_client.connected()) {
+      request.closed = true;
+      finishStats(-1);
+      return true;
+    }
+    return waitStats();
+  }
+  request.sent += len;
+  request.since = millis();
+  if (request.sent == total) {
+    request.state = STATS_READ;
+  }
+  return true;
+}
+
+/*
+ * Reads whatever of the response has arrived.
+ */
+bool
+Network::readStats()
+{
+  uint8_t buf[STATS_READ_CHUNK];
+  int len = stats_client.available();
+  if (len <= 0) {
+    if (!stats_client.connected()) {
+      // Closed before answering, or at the end of a body without a length
+      request.closed = true;
+      finishStats(request.in_body ? request.status : -1);
+      return true;
+    }
+    return waitStats();
+  }
+  len = stats_client.read(buf,
+                          len < STATS_READ_CHUNK ? len : STATS_READ_CHUNK);
+  request.since = millis();
+  request.answered = true;
+  for (int i = 0; i < len && request.state == STATS_READ; i++) {
+    if (request.in_body && request.remaining) {
+      // Throw out the body, so the next response starts at its status line
+      if (--request.remaining == 0 && !request.chunked) {
+        finishStats(request.status);
+      }
+    } else if (request.in_body && !request.chunked) {
+      // The body runs until the server closes
+    } else if (buf[i] == '\n') {
+      request.line[request.line_len] = '\0';
+      if (request.in_body) {
+        parseChunkLine();
+      } else {
+        parseStatsLine();
+      }
+      request.line_len = 0;
+    } else if (buf[i] != '\r' && request.line_len < STATS_LINE_SIZE - 1) {
+      request.line[request.line_len++] = buf[i];
+    }
+  }
+  return true;
+}
+
+/*
+ * Handles a line of the response's status and headers.
+ */
+void
+Network::parseStatsLine()
+{
+  if (request.status < 0) {
+    if (strncmp(request.line, "HTTP/1.", 7) == 0) {
+      // Only HTTP/1.1 and later keep connections open by default
+      request.keep_alive = request.line[7] != '0';
+      request.status = atoi(request.line + 8);
+      DEBUG_MSG("Got response from server: %d\n", request.status);
+    }
+    return;
+  }
+  if (!request.line_len) {
+    if (request.status < 200) {
+      // Informational, the real response follows
+      request.status = -1;
+    } else if (request.status == 204 || request.status == 304 ||
+               (request.has_length && !request.chunked &&
+                !request.remaining)) {
+      finishStats(request.status);
+    } else if (request.chunked) {
+      // Each chunk gives its own length, and it overrides Content-Length
+      request.in_body = true;
+      request.remaining = 0;
+    } else {
+      request.in_body = true;
+      // Without a length, the body only ends when the server closes
+      request.keep_alive = request.keep_alive && request.has_length;
+    }
+    return;
+  }
+  char* value = strchr(request.line, ':');
+  if (!value) {
+    return;
+  }
+  *value++ = '\0';
+  while (*value == ' ') {
+    value++;
+  }
+  if (strcasecmp(request.line, "Content-Length") == 0) {
+    request.remaining = atol(value);
+    request.has_length = true;
+  } else if (strcasecmp(request.line, "Connection") == 0 &&
+             strcasecmp(value, "close") == 0) {
+    request.keep_alive = false;
+  } else if (strcasecmp(request.line, "Transfer-Encoding") == 0 &&
+             strcasecmp(value, "chunked") == 0) {
+    request.chunked = true;
+  }
+}
+
+/*
+ * Handles a line of a chunked body: a chunk's size, the end of a chunk's
+ * data, or the trailer after the empty chunk.
+ */
+void
+Network::parseChunkLine()
+{
+  if (request.last_chunk) {
+    if (!request.line_len) {
+      finishStats(request.status);
+    }
+    return;
+  }
+  if (!request.line_len) {
+    // The line break after a chunk's data
+    return;
+  }
+  // Sizes are in hex, and may be followed by extensions
+  request.remaining = strtoul(request.line, NULL, 16);
+  request.last_chunk = !request.remaining;
+}
+
+/*
+ * Gives up on the request once the server has kept it waiting too long. A
+ * server that's sent its status but never ends the body still answered.
+ */
+bool
+Network::waitStats()
+{
+  if (millis() - request.since < STATS_READ_TIMEOUT) {
+    return false;
+  }
+  DEBUG_MSG("Stats request timed out.\n");
+  finishStats(request.in_body ? request.status : -1);
+  return true;
+}
+
+/*
+ * Ends the stats request, reconnecting once if a kept connection went quiet.
+ */
+void
+Network::finishStats(int status)
+{
+  if (status < 0 && request.reused && !request.retried && request.closed &&
+      !request.answered) {
+    // The server may have closed the kept connection while it was idle. One
+    // that's just slow may already have the request, so it isn't sent again.
+    DEBUG_MSG("No response on kept connection, reconnecting.\n");
+    stats_client.stop();
+    request.retried = true;
+    request.state = STATS_RESOLVE;
+    return;
+  }
+  if (status < 0 || !request.keep_alive) {
+    stats_client.stop();
+  }
+  request.state = STATS_IDLE;
+  if (status < 0 || status >= 500) {
+    stats_health.failure(request.started);
+  } else {
+    stats_health.success();
+  }
+  stats_accepted = status >= 200 && status < 300;
+  if (request.kind == STATS_DRAIN) {
+    if (stats_accepted) {
+      spool.pop(request.drain_count);
+    }
+  } else if (stats_accepted) {
+    batch_count = 0;
+    // Catch up on spooled samples on the next call
+    last_drained = 0;
+  } else {
+    // The stats that didn't go out are added to the next report
+    merge_sample_stats(aggregates, sent_aggregates);
+    if (monitor_config->stats_batch_size <= 1) {
+      // Batches keep their samples until they're sent, or full
+      spool.push(request.entry);
+    }
+  }
+}
+
+/*
+ * Adds a sample to the batch, making room by spooling the oldest if the
+ * batch is full.
+ */
+void
+Network::addToBatch(StatsEntry& entry)
+{
+  if (batch_count == STATS_BATCH_CAPACITY) {
+    DEBUG_MSG("Stats batch is full, spooling sample from %d.\n",
+              batch[batch_start].timestamp);
+    spool.push(batch[batch_start]);
+    batch_start = (batch_start + 1) % STATS_BATCH_CAPACITY;
+    batch_count--;
+  }
+  batch[(batch_start + batch_count) % STATS_BATCH_CAPACITY] = entry;
+  batch_count++;
+}
+
+/*
+ * Formats the batch as a JSON array of samples, oldest first. The newest
+ * sample also has the running stats and bus health.
+ */
+size_t
+Network::formatBatch(char* buf, size_t len)
+{
+  size_t size = snprintf(buf, len, "[");
+  for (byte i = 0; i < batch_count; i++) {
+    StatsEntry& entry = batch[(batch_start + i) % STATS_BATCH_CAPACITY];
+    size += format_entry(buf + size, len - size, entry);
+    if (i == batch_count - 1) {
+      size += formatReport(buf + size, len - size, entry.num_probes);
+    }
+    size += snprintf(buf + size, len - size, i == batch_count - 1 ? "}" : "},");
+  }
+  size += snprintf(buf + size, len - size, "]");
+  return size;
+}
+
+/*
+ * Formats the running stats and bus health as JSON members.
+ */
+size_t
+Network::formatReport(char* buf, size_t len, byte num_probes)
+{
+  size_t size = snprintf(buf, len, ",\"agg\":{\"humidity\":");
+  size += format_running_stat(buf + size, len - size, aggregates.humidity);
+  size += snprintf(buf + size, len - size, ",\"air_temp\":");
+  size += format_running_stat(buf + size, len - size, aggregates.air_temp);
+  size += snprintf(buf + size, len - size, ",\"high_temp\":");
+  size += format_running_stat(buf + size, len - size, aggregates.high_temp);
+  size += snprintf(buf + size, len - size, ",\"low_temp\":");
+  size += format_running_stat(buf + size, len - size, aggregates.low_temp);
+  size += snprintf(buf + size, len - size, ",\"probes\":[");
+  for (int i = 0; i < num_probes && i < MAX_THERM_SENSORS; i++) {
+    if (i > 0) {
+      size += snprintf(buf + size, len - size, ",");
+    }
+    size += format_running_stat(buf + size, len - size, aggregates.probes[i]);
+  }
+  size += snprintf(buf + size, len - size, "]}");
+  if (bus_health) {
+    size += format_bus_stats(buf + size, len - size, "i2c", bus_health->i2c);
+    size +=
+      format_bus_stats(buf + size, len - size, "onewire", bus_health->onewire);
+    size += snprintf(buf + size,
+                     len - size,
+                     ",\"probe_changes\":%lu",
+                     bus_health->probe_changes);
+    if (monitor_config->output_protocol == OUTPUT_PROTOCOL_V2) {
+      size += snprintf(buf + size,
+                       len - size,
+                       ",\"outputs_acked\":%s",
+                       bus_health->outputs_acknowledged ? "true" : "false");
+    }
+  }
+  return size;
 }
@@ -7,19 +7,94 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
+#include "EndpointHealth.h"
+#include "Spool.h"
 #include "types.h"
 #include <time.h>
 
+/*
+ * Most samples that can be sent in one request
+ */
+#define STATS_BATCH_CAPACITY 6
+
+/*
+ * Steps of a stats request, which moves forward a little on each post_stats
+ * call
+ */
+#define STATS_IDLE 0
+#define STATS_RESOLVE 1
+#define STATS_CONNECT 2
+#define STATS_WRITE 3
+#define STATS_READ 4
+
+/*
+ * What a stats request is sending
+ */
+#define STATS_LIVE 0
+#define STATS_DRAIN 1
+
+/*
+ * Longest response line kept while reading the status and headers
+ */
+#define STATS_LINE_SIZE 32
+
+/*
+ * A stats request in progress, and what's been read of its response
+ */
+typedef struct StatsRequest
+{
+  byte state;
+  byte kind;
+  byte drain_count;    // Spooled samples in the body
+  StatsEntry entry;    // Live sample to spool if the post fails
+  time_t started;
+  bool reused;         // Sent on a connection kept from the last request
+  bool retried;        // Already reconnected once
+  bool closed;         // The server closed the connection
+  bool answered;       // Some of the response has arrived
+  bool resolving;      // Waiting on the server's address
+  unsigned long since; // millis() when the server last made progress
+  size_t header_len;
+  size_t body_len;
+  size_t sent;
+  int status; // -1 until the status line is read
+  bool keep_alive;
+  bool in_body;
+  bool has_length;
+  bool chunked;
+  bool last_chunk;  // The empty chunk is in, only the trailer is left
+  size_t remaining; // Body or chunk bytes left to read
+  char line[STATS_LINE_SIZE];
+  byte line_len;
+} StatsRequest;
+
+/*
+ * Adds a value to a channel's running stats, using Welford's method.
+ */
+void add_running_stat(RunningStats& stats, float value);
+
+/*
+ * Adds one channel's running stats into another's.
+ */
+void merge_running_stats(RunningStats& stats, const RunningStats& other);
+
+/*
+ * Sample variance of the values added so far, 0 until there are two.
+ */
+float running_variance(const RunningStats& stats);
+
 /*
  * Interface to network components.
  */
 class Network
 {
 public:
-  void init(VivariumMonitorConfig* config, Url update_endpoint);
+  void init(VivariumMonitorConfig* config,
+            Url update_endpoint,
+            const BusHealth* health = NULL);
   void update_firmware(time_t now);
   void serve_web_interface();
-  void post_stats(SensorData& readings,
+  void post_stats(SensorData& sample,
                   byte digital_1,
                   byte digital_2,
                   byte analog);
@@ -27,7 +102,37 @@ public:
 private:
   ViviariumMonitorConfig* monitor_config = NULL;
   Url update_url;
+  const BusHealth* bus_health = NULL;
   SensorData last_collected;
+  SampleStats aggregates;
+  SampleStats sent_aggregates; // In the live request that's out
+  time_t last_aggregated = 0;
+  StatsEntry batch[STATS_BATCH_CAPACITY]; // Ring buffer, oldest first
+  byte batch_start = 0;
+  byte batch_count = 0;
+  Spool spool;
+  bool stats_accepted = false; // Server took the last request
+  time_t last_drained = 0;
+  StatsRequest request;
+  EndpointHealth stats_health;
+  EndpointHealth update_health;
+  // Resolved address of the stats server, 0 if unknown
+  unsigned long stats_ip = 0;
+  void aggregate(SensorData& readings);
+  void addToBatch(StatsEntry& entry);
+  size_t formatBatch(char* buf, size_t len);
+  size_t formatReport(char* buf, size_t len, byte num_probes);
+  void drainSpool(time_t now);
+  void startStats(byte kind, size_t len, time_t now);
+  void runStats();
+  bool stepStats();
+  void beginStatsWrite();
+  bool writeStats();
+  bool readStats();
+  void parseStatsLine();
+  void parseChunkLine();
+  bool waitStats();
+  void finishStats(int status);
   time_t last_fw_check = 0;
   time_t last_sent = 0;
 };
@@ -37,15 +142,88 @@ private:
  */
 #define HTTP_TIMEOUT 8000
 
+/*
+ * Stats requests wait this many milliseconds for the server's address, and
+ * this many for the server between writes or reads
+ */
+#define STATS_RESOLVE_TIMEOUT 2000
+#define STATS_READ_TIMEOUT 5000
+
+/*
+ * Milliseconds a stats request can block while connecting. WiFiClient has no
+ * way to connect without waiting, so this is kept short enough not to hold
+ * up the outputs.
+ */
+#define STATS_CONNECT_TIMEOUT 250
+
+/*
+ * Microseconds a stats request can run for on each post_stats call
+ */
+#define STATS_STEP_BUDGET 1000
+
+/*
+ * Bytes read from the response at once
+ */
+#define STATS_READ_CHUNK 64
+
+/*
+ * Size of the stats request line and headers
+ */
+#define STATS_HEADER_SIZE (2 * CONFIG_STR_LEN + 150)
+
+/*
+ * Most spooled samples sent in one request, and seconds between requests
+ * when there's no live post to follow
+ */
+#define SPOOL_DRAIN_ENTRIES STATS_BATCH_CAPACITY
+#define SPOOL_DRAIN_SECONDS 5
+
+/*
+ * Readings older than this many of their source's sample intervals are
+ * reported as missing
+ */
+#define STALE_READING_INTERVALS 3
+
 /*
  * Interval to check for firmware updates
  */
 #define FIRMWARE_CHECK_SECONDS 14400
 
 /*
- * Size of JSON text buffer
+ * Seconds to wait after an endpoint's first failure, and for its breaker to
+ * cool down. A failed firmware check is retried before the check interval.
+ */
+#define STATS_BACKOFF_SECONDS 10
+#define STATS_COOLDOWN_SECONDS 1800
+#define FIRMWARE_BACKOFF_SECONDS 600
+#define FIRMWARE_COOLDOWN_SECONDS 86400
+
+/*
+ * Size of JSON text buffer, big enough for a full batch
+ */
+#define JSONBUF_SIZE                                                           \
+  (30 + STATS_BATCH_CAPACITY * (SAMPLE_JSON_SIZE + 1) + 2 * BUS_JSON_SIZE +   \
+   AGG_JSON_SIZE)
+
+/*
+ * Max size of the JSON for one sample
+ */
+#define SAMPLE_JSON_SIZE (178 + VALUE_JSON_SIZE * MAX_THERM_SENSORS)
+
+/*
+ * Size of one formatted value, enough for "-128.00"
+ */
+#define VALUE_JSON_SIZE 8
+
+/*
+ * Max size of the JSON for one bus's health counters
+ */
+#define BUS_JSON_SIZE 180
+
+/*
+ * Max size of the JSON for the running stats of every channel
  */
-#define JSONBUF_SIZE 166
+#define AGG_JSON_SIZE (60 + 56 * (4 + MAX_THERM_SENSORS))
 
 /*
  * Primary interface highlight color
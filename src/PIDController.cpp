@@ -29,7 +29,7 @@ PIDController::add_reading(SensorReading reading, time_t timestamp)
     // Initialize dt to sane value to prevent swing on startup.
     dt = 1;
   }
-  if (reading.has_error || !dt) {
+  if (reading.error || !dt) {
     // In the case of a sensor error, or no time passed, return last value
     error = _prev_error;
     derivative = 0;
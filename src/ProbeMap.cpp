@@ -0,0 +1,207 @@
+/*
+ * ProbeMap.cpp
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#include "ProbeMap.h"
+#include "debug.h"
+
+#include <string.h>
+
+/*
+ * FNV-1a, folded into a bucket number.
+ */
+static byte
+name_bucket(const char* name)
+{
+  unsigned long hash = 2166136261UL;
+  for (const char* c = name; *c; c++) {
+    hash = (hash ^ (byte)*c) * 16777619UL;
+  }
+  return (hash ^ (hash >> 16)) & (PROBE_MAP_BUCKETS - 1);
+}
+
+/*
+ * The last ROM byte is its CRC, which is already well spread out.
+ */
+static byte
+addr_bucket(const byte* addr)
+{
+  return (addr[7] ^ addr[1]) & (PROBE_MAP_BUCKETS - 1);
+}
+
+ProbeMap::ProbeMap()
+{
+  clear();
+}
+
+void
+ProbeMap::clear()
+{
+  memset(channels, 0, sizeof(channels));
+  unsaved = false;
+  reindex();
+}
+
+/*
+ * Reads a map written by save. Returns false, leaving the map empty, if it
+ * is missing or from a build with a different number of channels.
+ */
+bool
+ProbeMap::load(Stream& in)
+{
+  clear();
+  if (in.readBytes((char*)channels, sizeof(channels)) != sizeof(channels)) {
+    DEBUG_MSG("!!! Probe map is unreadable, ignoring it.\n");
+    clear();
+    return false;
+  }
+  for (byte i = 0; i < MAX_THERM_SENSORS; i++) {
+    channels[i].name[PROBE_NAME_LEN - 1] = '\0';
+  }
+  reindex();
+  return true;
+}
+
+void
+ProbeMap::save(Print& out)
+{
+  out.write((const uint8_t*)channels, sizeof(channels));
+  unsaved = false;
+}
+
+/*
+ * Pins a probe to a slot, replacing whatever was there. Keeps the slot's name
+ * if none is given.
+ */
+void
+ProbeMap::assign(byte slot, const byte* addr, const char* name)
+{
+  if (slot >= MAX_THERM_SENSORS) {
+    return;
+  }
+  int old = this->slot(addr);
+  if (old >= 0 && old != slot) {
+    memset(channels[old].addr, 0, sizeof(channels[old].addr));
+  }
+  memcpy(channels[slot].addr, addr, sizeof(channels[slot].addr));
+  if (name) {
+    strlcpy(channels[slot].name, name, PROBE_NAME_LEN);
+  }
+  unsaved = true;
+  reindex();
+}
+
+/*
+ * Names a slot, taking the name from any other slot that had it. An empty
+ * or NULL name clears it. Returns false if there's no such slot.
+ */
+bool
+ProbeMap::rename(byte slot, const char* name)
+{
+  if (slot >= MAX_THERM_SENSORS) {
+    return false;
+  }
+  int old = this->slot(name);
+  if (old >= 0 && old != slot) {
+    channels[old].name[0] = '\0';
+  }
+  strlcpy(channels[slot].name, name ? name : "", PROBE_NAME_LEN);
+  unsaved = true;
+  reindex();
+  return true;
+}
+
+/*
+ * The ROM address pinned to a slot, NULL if there isn't one.
+ */
+const byte*
+ProbeMap::address(byte slot) const
+{
+  if (slot >= MAX_THERM_SENSORS || channels[slot].addr[0] == 0) {
+    return NULL;
+  }
+  return channels[slot].addr;
+}
+
+const char*
+ProbeMap::name(byte slot) const
+{
+  if (slot >= MAX_THERM_SENSORS) {
+    return NULL;
+  }
+  return channels[slot].name;
+}
+
+/*
+ * The slot with the given name, -1 if there isn't one.
+ */
+int
+ProbeMap::slot(const char* name) const
+{
+  if (!name || !*name) {
+    return -1;
+  }
+  for (byte b = name_bucket(name);; b = (b + 1) & (PROBE_MAP_BUCKETS - 1)) {
+    byte slot = by_name[b];
+    if (slot == PROBE_MAP_EMPTY) {
+      return -1;
+    }
+    if (strcmp(channels[slot].name, name) == 0) {
+      return slot;
+    }
+  }
+}
+
+/*
+ * The slot a ROM address is pinned to, -1 if there isn't one.
+ */
+int
+ProbeMap::slot(const byte* addr) const
+{
+  for (byte b = addr_bucket(addr);; b = (b + 1) & (PROBE_MAP_BUCKETS - 1)) {
+    byte slot = by_addr[b];
+    if (slot == PROBE_MAP_EMPTY) {
+      return -1;
+    }
+    if (memcmp(channels[slot].addr, addr, sizeof(channels[slot].addr)) == 0) {
+      return slot;
+    }
+  }
+}
+
+/*
+ * True if the map was changed since it was loaded or saved.
+ */
+bool
+ProbeMap::changed() const
+{
+  return unsaved;
+}
+
+/*
+ * Rebuilds the open addressed name and address tables. The tables are more
+ * than half empty, so lookups always end at an empty bucket.
+ */
+void
+ProbeMap::reindex()
+{
+  memset(by_name, PROBE_MAP_EMPTY, sizeof(by_name));
+  memset(by_addr, PROBE_MAP_EMPTY, sizeof(by_addr));
+  for (byte i = 0; i < MAX_THERM_SENSORS; i++) {
+    byte b;
+    if (channels[i].name[0]) {
+      for (b = name_bucket(channels[i].name); by_name[b] != PROBE_MAP_EMPTY;
+           b = (b + 1) & (PROBE_MAP_BUCKETS - 1)) {
+      }
+      by_name[b] = i;
+    }
+    if (channels[i].addr[0]) {
+      for (b = addr_bucket(channels[i].addr); by_addr[b] != PROBE_MAP_EMPTY;
+           b = (b + 1) & (PROBE_MAP_BUCKETS - 1)) {
+      }
+      by_addr[b] = i;
+    }
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ * ProbeMap.h
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#ifndef PROBEMAP_H
+#define PROBEMAP_H
+
+#include "types.h"
+#include <Stream.h>
+
+#define PROBE_MAP_BUCKETS 32 // Power of two, at least 2 * MAX_THERM_SENSORS
+#define PROBE_MAP_EMPTY 0xFF
+
+/*
+ * Pins DS18B20 ROM addresses to channels in SensorData.probes, so a probe
+ * keeps its channel however the buses enumerate it. Channels can be looked
+ * up by slot, name or address in constant time.
+ */
+class ProbeMap
+{
+public:
+  ProbeMap();
+  void clear();
+  bool load(Stream& in);
+  void save(Print& out);
+  void assign(byte slot, const byte* addr, const char* name = NULL);
+  bool rename(byte slot, const char* name);
+  const byte* address(byte slot) const;
+  const char* name(byte slot) const;
+  int slot(const char* name) const;
+  int slot(const byte* addr) const;
+  bool changed() const;
+
+private:
+  ProbeChannel channels[MAX_THERM_SENSORS];
+  byte by_name[PROBE_MAP_BUCKETS];
+  byte by_addr[PROBE_MAP_BUCKETS];
+  bool unsaved;
+  void reindex();
+};
+
+#endif
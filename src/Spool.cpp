@@ -0,0 +1,171 @@
+/*
+ * Spool.cpp
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#include "Spool.h"
+#include "debug.h"
+
+#include <LittleFS.h>
+
+/*
+ * Appends a sample, dropping the oldest segment if the spool is full.
+ * Returns false if the filesystem can't be written.
+ */
+bool
+Spool::push(const StatsEntry& entry)
+{
+  char path[24];
+  if (!mount()) {
+    return false;
+  }
+  segmentPath(path, head.last);
+  // A new segment may have a file left over from a dropped spool
+  File segment = LittleFS.open(path, head.written ? "a" : "w");
+  if (!segment) {
+    DEBUG_MSG("Error, cannot open %s! Dropping sample.\n", path);
+    LittleFS.end();
+    return false;
+  }
+  segment.write((const uint8_t*)&entry, sizeof(entry));
+  segment.close();
+
+  if (++head.written == SPOOL_SEGMENT_ENTRIES) {
+    head.last++;
+    head.written = 0;
+    if (head.last - head.first >= SPOOL_SEGMENTS) {
+      DEBUG_MSG("Spool is full, dropping the oldest samples.\n");
+      segmentPath(path, head.first);
+      LittleFS.remove(path);
+      head.first++;
+      head.read = 0;
+    }
+  }
+  save();
+  LittleFS.end();
+  return true;
+}
+
+/*
+ * Reads up to max of the oldest samples without removing them. Returns how
+ * many were read.
+ */
+byte
+Spool::peek(StatsEntry* entries, byte max)
+{
+  char path[24];
+  if (!size() || !mount()) {
+    return 0;
+  }
+  unsigned int count = segmentSize(head.first) - head.read;
+  if (count > max) {
+    count = max;
+  }
+  segmentPath(path, head.first);
+  File segment = LittleFS.open(path, "r");
+  size_t len = count * sizeof(StatsEntry);
+  if (!segment || !segment.seek(head.read * sizeof(StatsEntry)) ||
+      segment.readBytes((char*)entries, len) != len) {
+    DEBUG_MSG("Error, cannot read %s! Dropping it.\n", path);
+    if (segment) {
+      segment.close();
+    }
+    LittleFS.end();
+    pop(segmentSize(head.first) - head.read);
+    return 0;
+  }
+  segment.close();
+  LittleFS.end();
+  return count;
+}
+
+/*
+ * Removes the oldest samples, once they've been sent.
+ */
+void
+Spool::pop(byte count)
+{
+  char path[24];
+  if (!mount()) {
+    return;
+  }
+  head.read += count;
+  if (head.read >= segmentSize(head.first)) {
+    segmentPath(path, head.first);
+    LittleFS.remove(path);
+    if (head.first == head.last) {
+      head.written = 0;
+    } else {
+      head.first++;
+    }
+    head.read = 0;
+  }
+  save();
+  LittleFS.end();
+}
+
+/*
+ * Number of samples waiting to be sent.
+ */
+unsigned long
+Spool::size()
+{
+  if (!loaded && mount()) {
+    LittleFS.end();
+  }
+  return (head.last - head.first) * SPOOL_SEGMENT_ENTRIES + head.written -
+         head.read;
+}
+
+/*
+ * Mounts the filesystem, and reads where the spool is the first time.
+ */
+bool
+Spool::mount()
+{
+  if (!LittleFS.begin()) {
+    DEBUG_MSG("Error, cannot mount FS! Spool unavailable.\n");
+    return false;
+  }
+  if (!loaded) {
+    head = {};
+    if (LittleFS.exists(SPOOL_HEAD_FILE)) {
+      File headFile = LittleFS.open(SPOOL_HEAD_FILE, "r");
+      if (headFile.readBytes((char*)&head, sizeof(head)) != sizeof(head) ||
+          head.magic != SPOOL_MAGIC || head.entry_size != sizeof(StatsEntry)) {
+        DEBUG_MSG("Spool head is unreadable or from other firmware, starting "
+                  "over.\n");
+        head = {};
+      }
+      headFile.close();
+    }
+    head.magic = SPOOL_MAGIC;
+    head.entry_size = sizeof(StatsEntry);
+    loaded = true;
+  }
+  return true;
+}
+
+void
+Spool::save()
+{
+  File headFile = LittleFS.open(SPOOL_HEAD_FILE, "w");
+  headFile.write((const uint8_t*)&head, sizeof(head));
+  headFile.close();
+}
+
+/*
+ * Samples written to a segment.
+ */
+unsigned int
+Spool::segmentSize(unsigned long segment)
+{
+  return segment == head.last ? head.written : SPOOL_SEGMENT_ENTRIES;
+}
+
+void
+Spool::segmentPath(char* buf, unsigned long segment)
+{
+  sprintf(buf, SPOOL_SEGMENT_FILE, segment);
+}
@@ -0,0 +1,54 @@
+/*
+ * Spool.h
+ * Copyright Sal Skare
+ * Released under GPL3 license
+ */
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "types.h"
+
+#define SPOOL_HEAD_FILE "/spool_head"
+#define SPOOL_SEGMENT_FILE "/spool_%lu"
+#define SPOOL_SEGMENT_ENTRIES 32 // Samples in each segment file
+#define SPOOL_SEGMENTS 8         // Segments kept before the oldest is dropped
+#define SPOOL_MAGIC 0x53504c31   // "SPL1", bump if SpoolHead changes
+
+/*
+ * Where the spool's segments start and end, stored in SPOOL_HEAD_FILE. A
+ * spool written by firmware with a different layout is dropped.
+ */
+typedef struct SpoolHead
+{
+  unsigned long magic;     // SPOOL_MAGIC
+  unsigned int entry_size; // sizeof(StatsEntry) when the samples were written
+  unsigned long first;     // Oldest segment
+  unsigned long last;      // Segment being appended to
+  unsigned int read;       // Samples already sent from the oldest segment
+  unsigned int written;    // Samples in the last segment
+} SpoolHead;
+
+/*
+ * Stats samples that couldn't be sent, kept on LittleFS until they can be.
+ * Samples are appended to numbered segment files, and whole segments are
+ * dropped, oldest first, when the spool is full.
+ */
+class Spool
+{
+public:
+  bool push(const StatsEntry& entry);
+  byte peek(StatsEntry* entries, byte max);
+  void pop(byte count);
+  unsigned long size();
+
+private:
+  SpoolHead head = {};
+  bool loaded = false;
+  bool mount();
+  void save();
+  unsigned int segmentSize(unsigned long segment);
+  void segmentPath(char* buf, unsigned long segment);
+};
+
+#endif
@@ -117,6 +117,11 @@ VivariumMonitor::init(VivariumMonitorConfig config)
     } else {
       update_url.set = false;
     }
+    if (LittleFS.exists(PROBE_MAP_FILE)) {
+      File mapFile = LittleFS.open(PROBE_MAP_FILE, "r");
+      hardware_interface.probe_map()->load(mapFile);
+      mapFile.close();
+    }
     LittleFS.end();
   } else {
     update_url.set = false;
@@ -131,7 +136,8 @@ VivariumMonitor::init(VivariumMonitorConfig config)
   updateUrls = false;
 
   // Initialize submodules
-  net_interface.init(&monitor_config, update_url);
+  net_interface.init(
+    &monitor_config, update_url, hardware_interface.bus_health());
   hardware_interface.init(&monitor_config);
 
   // Give NTP time to sync
@@ -163,6 +169,11 @@ VivariumMonitor::handle_events()
     hardware_interface.set_digital_2(digital_2_out);
   }
 
+  if (hardware_interface.probe_map()->changed() &&
+      (!map_save_failed || millis() - map_save_failed_at >= PROBE_MAP_RETRY)) {
+    saveProbeMap();
+  }
+
   hardware_interface.write_outputs();
   net_interface.post_stats(data, digital_1_out, digital_2_out, analog_out);
 
@@ -174,3 +185,58 @@ VivariumMonitor::handle_events()
   telnet.loop();
 #endif
 }
+
+/*
+ * Which channel in SensorData.probes has the DS18B20 with the given name, -1
+ * if none does.
+ */
+int
+VivariumMonitor::probeChannel(const char* name)
+{
+  return hardware_interface.probe_map()->slot(name);
+}
+
+/*
+ * Names a channel in SensorData.probes, so probeChannel can find it. The name
+ * is saved with the probe channels on the next handle_events call.
+ */
+bool
+VivariumMonitor::nameProbeChannel(byte channel, const char* name)
+{
+  return hardware_interface.probe_map()->rename(channel, name);
+}
+
+/*
+ * Whether the output controller confirmed it applied the last outputs. Always
+ * false unless output_protocol is OUTPUT_PROTOCOL_V2.
+ */
+bool
+VivariumMonitor::outputsAcknowledged()
+{
+  return hardware_interface.outputs_acknowledged();
+}
+
+/**********************************************************
+   Private functions
+ **********************************************************/
+
+/*
+ * Stores the DS18B20 channels, so probes keep them after a restart. If the
+ * filesystem can't be mounted, it isn't tried again for PROBE_MAP_RETRY.
+ */
+void
+VivariumMonitor::saveProbeMap()
+{
+  if (!LittleFS.begin()) {
+    DEBUG_MSG("Error, cannot mount FS! Probe channels not saved.\n");
+    map_save_failed = true;
+    map_save_failed_at = millis();
+    return;
+  }
+  map_save_failed = false;
+  File mapFile = LittleFS.open(PROBE_MAP_FILE, "w");
+  hardware_interface.probe_map()->save(mapFile);
+  mapFile.close();
+  LittleFS.end();
+  DEBUG_MSG("Saved probe channels.\n");
+}
@@ -16,6 +16,8 @@
 
 #define CONFIG_TIMEOUT 300
 #define FW_URL_FILE F("/fw_url")
+#define PROBE_MAP_FILE F("/probe_map")
+#define PROBE_MAP_RETRY 600000 // ms to wait after the probe map can't be saved
 
 /*
  * Interfaces to the sensors, as well as the output controller.
@@ -28,6 +30,9 @@ public:
   void setDigitalTwoHandler(byte (*)(SensorData, time_t));
   void setAnalogHandler(byte (*)(SensorData, time_t));
   void handle_events();
+  int probeChannel(const char* name);
+  bool nameProbeChannel(byte channel, const char* name);
+  bool outputsAcknowledged();
 
 private:
   VivariumMonitorConfig monitor_config;
@@ -36,6 +41,9 @@ private:
   byte (*analog_func)(SensorData, time_t) = NULL;
   Network net_interface;
   Hardware hardware_interface;
+  bool map_save_failed = false;
+  unsigned long map_save_failed_at = 0;
+  void saveProbeMap();
 };
 
 #endif
@@ -9,6 +9,8 @@
 
 #include <time.h>
 #define CONFIG_STR_LEN 126
+#define MAX_THERM_SENSORS 16
+#define MAX_ONE_WIRE_BUSES 4
 
 #ifndef byte
 typedef unsigned char byte;
@@ -17,15 +19,36 @@ typedef unsigned char byte;
 #include <stdbool.h>
 #endif
 
+/*
+ * Why a sensor reading failed, SENSOR_OK if it didn't.
+ */
+#define SENSOR_OK 0
+#define SENSOR_NOT_READ 1   // Not measured yet, or the sensor isn't enabled
+#define SENSOR_CRC_ERROR 2  // Data was corrupted on the way
+#define SENSOR_SHORT_READ 3 // Device sent back less than expected
+#define SENSOR_BUS_ERROR 4  // Bus is stuck or busy recovering
+#define SENSOR_MISSING 5    // Device didn't answer or reported a fault
+#define SENSOR_STALE 6      // Value is too old to be used
+
 /*
  * A monad that indicates if a sensor reading was sucessful, and its value.
  */
 typedef struct SensorReading
 {
-  bool has_error;
+  byte error; // One of the SENSOR_* values
   float value;
+  time_t timestamp; // When the value was last measured, 0 if never
 } SensorReading;
 
+/*
+ * Seconds since a reading's value was measured.
+ */
+inline time_t
+reading_age(const SensorReading& reading, time_t now)
+{
+  return now - reading.timestamp;
+}
+
 /*
  * A collection of sensor readings.
  */
@@ -35,9 +58,112 @@ typedef struct SensorData
   SensorReading air_temp;
   SensorReading high_temp;
   SensorReading low_temp;
+  SensorReading probes[MAX_THERM_SENSORS]; // Each DS18B20 sensor, by index
+  unsigned int num_probes;
   time_t timestamp;
 } SensorData;
 
+/*
+ * Count, range, mean and variance of a channel's readings, kept up to date
+ * one reading at a time.
+ */
+typedef struct RunningStats
+{
+  unsigned long count;
+  float min;
+  float max;
+  float mean;
+  float m2; // Sum of squared differences from the mean
+} RunningStats;
+
+/*
+ * Running stats of every channel in SensorData.
+ */
+typedef struct SampleStats
+{
+  RunningStats humidity;
+  RunningStats air_temp;
+  RunningStats high_temp;
+  RunningStats low_temp;
+  RunningStats probes[MAX_THERM_SENSORS];
+} SampleStats;
+
+/*
+ * A sample as it's reported to the stats server, along with the outputs at
+ * the time.
+ */
+#define STATS_HIGH_TEMP 0 // Indexes in StatsEntry.values
+#define STATS_LOW_TEMP 1
+#define STATS_AIR_TEMP 2
+#define STATS_HUMIDITY 3
+#define STATS_PROBES 4
+typedef struct StatsEntry
+{
+  time_t timestamp;
+  float values[STATS_PROBES + MAX_THERM_SENSORS];
+  unsigned long valid; // Bit for each value, set if it had no error
+  byte num_probes;
+  byte digital_1;
+  byte digital_2;
+  byte analog;
+} StatsEntry;
+
+/*
+ * A DS18B20 pinned to a channel in SensorData.probes. Unused channels have
+ * an all zero address.
+ */
+#define PROBE_NAME_LEN 16
+typedef struct ProbeChannel
+{
+  byte addr[8]; // OneWire ROM address
+  char name[PROBE_NAME_LEN];
+} ProbeChannel;
+
+/*
+ * SHT40 measurement repeatability. Lower precision measurements finish
+ * sooner.
+ */
+#define SHT_PRECISION_HIGH 0
+#define SHT_PRECISION_MEDIUM 1
+#define SHT_PRECISION_LOW 2
+
+/*
+ * Protocols for talking to the output controller. V2 frames carry a CRC-8
+ * and are read back from the controller to confirm they were applied.
+ */
+#define OUTPUT_PROTOCOL_V1 0
+#define OUTPUT_PROTOCOL_V2 2
+
+/*
+ * Counters for the traffic on a sensor bus. failures[0] counts reads that
+ * came back short or not at all, failures[1-5] count i2c endTransmission()
+ * errors by status code. Latencies are in microseconds.
+ */
+#define BUS_FAILURE_CODES 6
+typedef struct BusStats
+{
+  unsigned long transactions;
+  unsigned long failures[BUS_FAILURE_CODES];
+  unsigned long crc_failures;
+  unsigned long resets;
+  unsigned long latency_min;
+  unsigned long latency_max;
+  unsigned long latency_total;
+} BusStats;
+
+/*
+ * Health of the i2c and OneWire buses, and the devices on them. For OneWire,
+ * failures[0] counts probes that didn't respond and resets counts rescans of
+ * the bus.
+ */
+typedef struct BusHealth
+{
+  BusStats i2c;
+  BusStats onewire;
+  unsigned long probe_changes; // DS18B20s added, removed or swapped
+  bool outputs_acknowledged;   // Output controller applied the last outputs
+} BusHealth;
+
 /*
  * Simple URL definition
  */
@@ -56,8 +182,20 @@ typedef struct VivariumMonitorConfig
 {
   // Hardware setup
   bool has_sht_sensor;
+  byte sht_precision; // One of the SHT_PRECISION_* values
+  byte sht_heater_rh; // Run the SHT40 heater above this RH, 0 for default
   unsigned int num_therm_sensors;
   unsigned int sample_interval;
+  unsigned int sht_interval;    // Seconds between SHT40 reads, 0 for default
+  unsigned int therm_interval;  // Seconds between DS18B20 reads, 0 for default
+  bool async_temp_reads;        // Don't block during DS18B20 conversions
+  unsigned int temp_resolution; // DS18B20 bits (9-12), 0 picks automatically
+  byte num_one_wire_buses;      // 0 for every DS18B20 on ONE_WIRE_BUS
+  byte one_wire_pins[MAX_ONE_WIRE_BUSES];
+  byte one_wire_probes[MAX_ONE_WIRE_BUSES]; // DS18B20s on each bus
+  byte output_protocol;                     // An OUTPUT_PROTOCOL_* value
+  // Hz, 0 for 100kHz. Faster clocks drop back on errors
+  unsigned long i2c_clock;
 
   // Time setup
   const char* ntp_zone;
@@ -66,6 +204,8 @@ typedef struct VivariumMonitorConfig
   // Network endpoint setup
   Url stats_url;
   unsigned int stats_interval;
+  byte stats_batch_size;            // Samples per request, 0 or 1 to not batch
+  unsigned int stats_batch_seconds; // Send a partial batch this old, 0 waits
 } ViviariumMonitorConfig;
 
 #endif